@@ -1,6 +1,10 @@
 #include <iostream>
 #include "products.hpp"
 #include "productservice.hpp"
+#include "ctdengine.hpp"
+#include "productregistry.hpp"
+#include "lifecycleengine.hpp"
+#include "productquery.hpp"
 
 void testFutureProductService()
 {
@@ -14,11 +18,11 @@ void testFutureProductService()
   
 	string f1_tBondMar20 = "T-Bond Mar20";
 	date f1_maturityDate(2020, Mar, 1);
-	BondFuture f1(f1_tBondMar20, treasuryBond, f1_maturityDate, 100000, 0.01, "ZB", "158-15");
+	BondFuture f1(f1_tBondMar20, treasuryBond, f1_maturityDate, 100000, 1.0 / 32, "ZB", "158-15");
 
 	string f2_tBondJun20 = "T-Bond Jun20";
 	date f2_maturityDate(2020, Jun, 1);
-	BondFuture f2(f2_tBondJun20, treasuryBond, f2_maturityDate, 100000, 0.01, "ZB", "158-11");
+	BondFuture f2(f2_tBondJun20, treasuryBond, f2_maturityDate, 100000, 1.0 / 32, "ZB", "158-11");
 
 	string f3_eurodollarMar20 = "Eurodollar Mar20";
 	date f3_maturityDate(2020, Mar, 1);
@@ -36,6 +40,10 @@ void testFutureProductService()
 	std::cout << "Future: " << futureProductService->GetData(f1_tBondMar20).GetProductId() << " == > " << f1_tBondMar20 << std::endl;
 	std::cout << "Future: " << futureProductService->GetData(f2_tBondJun20).GetProductId() << " == > " << f2_tBondJun20 << std::endl;
 	std::cout << "Future: " << futureProductService->GetData(f3_eurodollarMar20).GetProductId() << " == > " << f3_eurodollarMar20 << std::endl;
+
+	// compare prices in ticks
+	std::cout << "Price: " << f1.GetPriceQuote() << " (" << f1.GetPrice().GetTicks() << " ticks) > " << f2.GetPriceQuote() << " == > " << (f1.GetPrice() > f2.GetPrice()) << std::endl;
+	std::cout << "Price: " << f3.GetPriceQuote() << " (" << f3.GetPrice().GetTicks() << " ticks)" << std::endl;
 }
 
 void printSwaps(vector<IRSwap> swaps)
@@ -113,6 +121,225 @@ void testBondProductService()
 	std::cout << "Found " << bondProductService->GetBonds(ticker).size() << " bonds\n";
 }
 
+void testCheapestToDeliverEngine()
+{
+	// Create a deliverable basket of long bonds
+	BondProductService *bondProductService = new BondProductService();
+	Bond bond1("912810QZ4", CUSIP, "T", 3.125, date(2043, Feb, 15));
+	Bond bond2("912810RB6", CUSIP, "T", 2.875, date(2043, May, 15));
+	Bond bond3("912810RK6", CUSIP, "T", 2.500, date(2045, Feb, 15));
+	bondProductService->Add(bond1);
+	bondProductService->Add(bond2);
+	bondProductService->Add(bond3);
+
+	vector<string> basket;
+	basket.push_back(bond1.GetProductId());
+	basket.push_back(bond2.GetProductId());
+	basket.push_back(bond3.GetProductId());
+	BondFuture future("T-Bond Mar20", basket, date(2020, Mar, 1), 100000, 1.0 / 32, "ZB", "158-15");
+
+	// Compute the basis of every deliverable
+	CheapestToDeliverEngine *ctdEngine = new CheapestToDeliverEngine(*bondProductService, date(2020, Jan, 2), 0.015);
+	ctdEngine->AddFuture(future);
+	ctdEngine->SetFuturePrice(future, ParseTreasuryQuote("158-16", future.GetTickSize()));
+	ctdEngine->SetBondPrice(bond1.GetProductId(), 102.50);
+	ctdEngine->SetBondPrice(bond2.GetProductId(), 97.40);
+	ctdEngine->SetBondPrice(bond3.GetProductId(), 87.75);
+
+	const vector<DeliverableAnalytics> &analytics = ctdEngine->Calculate();
+	for (vector<DeliverableAnalytics>::const_iterator it = analytics.begin(); it != analytics.end(); ++it)
+		std::cout << it->bondId << " CF:" << it->conversionFactor << " gross:" << it->grossBasis << " net:" << it->netBasis << " repo:" << it->impliedRepo << (it->cheapestToDeliver ? " CTD" : "") << std::endl;
+
+	std::cout << "CTD of " << future.GetProductId() << " == > " << ctdEngine->GetCheapestToDeliver(future.GetProductId()).bondId << std::endl;
+}
+
+void testProductExport()
+{
+	// Create a swap and a bond service
+	IRSwapProductService *swapProductService = new IRSwapProductService();
+	IRSwap outright10YSwap("Spot-Outright-10Y", THIRTY_THREE_SIXTY, ACT_THREE_SIXTY_FIVE, SEMI_ANNUAL, LIBOR, TENOR_3M, date(2015, Nov, 16), date(2025, Nov, 16), USD, 10, SPOT, OUTRIGHT);
+	IRSwap imm2YSwap("IMM-Outright-2Y", ACT_THREE_SIXTY, ACT_THREE_SIXTY, QUARTERLY, EURIBOR, TENOR_6M, date(2015, Dec, 20), date(2017, Dec, 20), EUR, 2, IMM, OUTRIGHT);
+	swapProductService->Add(outright10YSwap);
+	swapProductService->Add(imm2YSwap);
+
+	BondProductService *bondProductService = new BondProductService();
+	Bond treasuryBond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16));
+	bondProductService->Add(treasuryBond);
+
+	// Export the swaps as CSV and the bonds as JSON lines
+	std::cout.flush();
+	ExportBuffer csvBuffer(stdout, CSV);
+	swapProductService->Export(csvBuffer);
+	csvBuffer.Flush();
+
+	ExportBuffer jsonBuffer(stdout, JSON_LINES);
+	bondProductService->Export(jsonBuffer);
+	jsonBuffer.Flush();
+	std::cout << "Exported " << csvBuffer.GetRecordCount() << " swaps and " << jsonBuffer.GetRecordCount() << " bonds" << std::endl;
+}
+
+void testBulkLoad()
+{
+	// Bulk load bonds in place, then reload the service from scratch
+	BondProductService *bondProductService = new BondProductService();
+	for (int reload = 0; reload < 2; ++reload)
+	{
+		bondProductService->Clear();
+		bondProductService->Reserve(100000);
+		bondProductService->BeginBatch();
+		for (int i = 0; i < 100000; ++i)
+			bondProductService->Emplace("BOND" + std::to_string(i), CUSIP, i % 2 ? "T" : "P", 2.25f, date(2025, Nov, 16));
+		bondProductService->EndBatch();
+	}
+
+	string ticker = "T";
+	std::cout << "Loaded " << bondProductService->GetBonds(ticker).size() << " bonds with ticker 'T'\n";
+}
+
+void testProductRegistry()
+{
+	// Create the services and a registry over them
+	BondProductService *bondProductService = new BondProductService();
+	IRSwapProductService *swapProductService = new IRSwapProductService();
+	FutureProductService *futureProductService = new FutureProductService();
+	ProductRegistry *productRegistry = new ProductRegistry(*bondProductService, *swapProductService, *futureProductService);
+
+	Bond treasuryBond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16));
+	IRSwap outright10YSwap("Spot-Outright-10Y", THIRTY_THREE_SIXTY, THIRTY_THREE_SIXTY, SEMI_ANNUAL, LIBOR, TENOR_3M, date(2015, Nov, 16), date(2025, Nov, 16), USD, 10, SPOT, OUTRIGHT);
+	BondFuture future("T-Bond Mar20", treasuryBond, date(2020, Mar, 1), 100000, 1.0 / 32, "ZB", "158-15");
+
+	// Add through the registry, or directly to a service
+	ProductHandle bondHandle = productRegistry->Add(treasuryBond);
+	productRegistry->Add(outright10YSwap);
+	futureProductService->Add(future);
+
+	// Resolve ids without knowing their product type
+	string productIds[] = { "912828M56", "Spot-Outright-10Y", "T-Bond Mar20" };
+	for (int i = 0; i < 3; ++i)
+	{
+		ProductHandle handle = productRegistry->Resolve(productIds[i]);
+		std::cout << "Product: " << productIds[i] << " == > handle " << handle << " " << ToName(PRODUCT_TYPE_NAMES, productRegistry->GetProductType(handle)) << std::endl;
+	}
+
+	ProductHandle handle;
+	std::cout << "Product: UNKNOWN == > " << (productRegistry->TryResolve("UNKNOWN", handle) ? "found" : "not found") << std::endl;
+	std::cout << "Bond by handle: " << productRegistry->GetBond(bondHandle) << std::endl;
+}
+
+void testVersionedSnapshots()
+{
+	// Load the morning bonds in one version
+	BondProductService *bondProductService = new BondProductService();
+	bondProductService->BeginBatch();
+	bondProductService->Add(Bond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16)));
+	bondProductService->Add(Bond("912828TW0", CUSIP, "T", 0.75, date(2017, Nov, 5)));
+	bondProductService->EndBatch();
+	size_t morningVersion = bondProductService->GetVersion();
+
+	// Intraday changes publish new versions
+	bondProductService->Add(Bond("912828TW0", CUSIP, "P", 0.75, date(2017, Nov, 5)));
+	bondProductService->Add(Bond("912810RK6", CUSIP, "T", 2.50, date(2045, Feb, 15)));
+
+	// Query the morning version and the latest one
+	string ticker = "T";
+	BondSnapshot morning = bondProductService->GetSnapshot(morningVersion);
+	BondSnapshot latest = bondProductService->GetSnapshot();
+	std::cout << "Version " << morning.GetVersion() << ": " << morning.GetSize() << " bonds, " << morning.GetBonds(ticker).size() << " with ticker 'T', 912828TW0 ticker " << morning.GetData("912828TW0").GetTicker() << std::endl;
+	std::cout << "Version " << latest.GetVersion() << ": " << latest.GetSize() << " bonds, " << latest.GetBonds(ticker).size() << " with ticker 'T', 912828TW0 ticker " << latest.GetData("912828TW0").GetTicker() << std::endl;
+}
+
+void testLifecycleEngine()
+{
+	// Create the services, a registry and a lifecycle engine as of 2017-11-01
+	BondProductService *bondProductService = new BondProductService();
+	IRSwapProductService *swapProductService = new IRSwapProductService();
+	FutureProductService *futureProductService = new FutureProductService();
+	ProductRegistry *productRegistry = new ProductRegistry(*bondProductService, *swapProductService, *futureProductService);
+	ProductLifecycleEngine *lifecycleEngine = new ProductLifecycleEngine(*productRegistry, date(2017, Nov, 1));
+
+	Bond treasuryBond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16));
+	lifecycleEngine->Add(treasuryBond);
+	lifecycleEngine->Add(Bond("912828TW0", CUSIP, "T", 0.75, date(2017, Nov, 5)));
+	lifecycleEngine->Add(IRSwap("IMM-Outright-2Y", THIRTY_THREE_SIXTY, THIRTY_THREE_SIXTY, SEMI_ANNUAL, LIBOR, TENOR_3M, date(2015, Dec, 16), date(2017, Dec, 16), USD, 2, IMM, OUTRIGHT));
+	lifecycleEngine->Add(BondFuture("T-Bond Dec17", treasuryBond, date(2017, Dec, 1), 100000, 1.0 / 32, "ZB", "154-02"));
+
+	// Roll the business date: each roll archives only the products expiring on the days rolled over
+	date rollDates[] = { date(2017, Nov, 6), date(2017, Dec, 4), date(2018, Jan, 2) };
+	for (int i = 0; i < 3; ++i)
+	{
+		size_t archived = lifecycleEngine->Roll(rollDates[i]);
+		std::cout << "Roll to " << rollDates[i] << ": archived " << archived << ", " << productRegistry->GetSize() << " live products" << std::endl;
+	}
+
+	std::cout << "Archived: " << lifecycleEngine->GetArchivedBonds().size() << " bonds, " << lifecycleEngine->GetArchivedSwaps().size() << " swaps, " << lifecycleEngine->GetArchivedFutures().size() << " futures" << std::endl;
+	std::cout << "Bond 912828TW0 live == > " << (bondProductService->Find("912828TW0") != 0) << std::endl;
+}
+
+void testProductQueryService()
+{
+	// Create the services and an asynchronous query front-end over them
+	BondProductService *bondProductService = new BondProductService();
+	IRSwapProductService *swapProductService = new IRSwapProductService();
+	bondProductService->Add(Bond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16)));
+	bondProductService->Add(Bond("912810RK6", CUSIP, "T", 2.50, date(2045, Feb, 15)));
+	swapProductService->Add(IRSwap("Spot-Outright-10Y", THIRTY_THREE_SIXTY, THIRTY_THREE_SIXTY, SEMI_ANNUAL, LIBOR, TENOR_3M, date(2015, Nov, 16), date(2025, Nov, 16), USD, 10, SPOT, OUTRIGHT));
+	ProductQueryService *queryService = new ProductQueryService(*bondProductService, *swapProductService);
+
+	// Submit a burst of queries; duplicates in flight share one future
+	vector<shared_future<shared_ptr<const Bond> > > bondFutures;
+	vector<shared_future<vector<Bond> > > tickerFutures;
+	for (int i = 0; i < 1000; ++i)
+	{
+		bondFutures.push_back(queryService->GetData(i % 2 == 0 ? "912828M56" : "912810RK6"));
+		tickerFutures.push_back(queryService->GetBonds("T"));
+	}
+	shared_future<vector<IRSwap> > swapFuture = queryService->GetSwapsGreaterThan(5);
+	shared_future<shared_ptr<const Bond> > unknownFuture = queryService->GetData("UNKNOWN");
+
+	std::cout << "Bond: " << bondFutures[0].get()->GetProductId() << " == > " << *bondFutures[0].get() << std::endl;
+	std::cout << "Bonds with ticker 'T': " << tickerFutures.back().get().size() << std::endl;
+	std::cout << "Swaps longer than 5yrs: " << swapFuture.get().size() << std::endl;
+	try
+	{
+		unknownFuture.get();
+	}
+	catch (const char *error)
+	{
+		std::cout << "Bond: UNKNOWN == > " << error << std::endl;
+	}
+
+	delete queryService;
+	std::cout << "Submitted " << bondFutures.size() + tickerFutures.size() + 2 << " queries, all answered" << std::endl;
+}
+
+void printMemoryUsage(const string &name, const MemoryUsage &usage)
+{
+	std::cout << name << ": " << usage.count << " entries, " << usage.payloadBytes << " payload bytes, " << usage.indexBytes << " index bytes, " << usage.GetBytesPerEntry() << " bytes each, " << usage.reservedBytes << " bytes reserved" << std::endl;
+}
+
+void testMemoryUsage()
+{
+	// Load bonds and futures and register them all
+	BondProductService *bondProductService = new BondProductService();
+	IRSwapProductService *swapProductService = new IRSwapProductService();
+	FutureProductService *futureProductService = new FutureProductService();
+	ProductRegistry *productRegistry = new ProductRegistry(*bondProductService, *swapProductService, *futureProductService);
+
+	Bond treasuryBond("912828M56", CUSIP, "T", 2.25, date(2025, Nov, 16));
+	bondProductService->BeginBatch();
+	for (int i = 0; i < 10000; ++i)
+	{
+		productRegistry->Add(Bond("BOND" + std::to_string(i), CUSIP, "T", 2.25f, date(2025, Nov, 16)));
+		productRegistry->Add(BondFuture("FUT" + std::to_string(i), treasuryBond, date(2020, Mar, 1), 100000, 1.0 / 32, "ZB", "158-15"));
+	}
+	bondProductService->EndBatch();
+
+	std::cout << "sizeof: Bond " << sizeof(Bond) << ", IRSwap " << sizeof(IRSwap) << ", Future " << sizeof(Future) << std::endl;
+	printMemoryUsage("Bonds", bondProductService->GetMemoryUsage());
+	printMemoryUsage("Futures", futureProductService->GetMemoryUsage());
+	printMemoryUsage("Registry", productRegistry->GetMemoryUsage());
+}
+
 int main()
 {
 	std::cout << "\n---- Test Future product Service ----\n";
@@ -124,6 +351,30 @@ int main()
 	std::cout << "\n---- Test Bond product Service ----\n";
 	testBondProductService();
 
+	std::cout << "\n---- Test Cheapest-to-deliver engine ----\n";
+	testCheapestToDeliverEngine();
+
+	std::cout << "\n---- Test product export ----\n";
+	testProductExport();
+
+	std::cout << "\n---- Test bulk load ----\n";
+	testBulkLoad();
+
+	std::cout << "\n---- Test product registry ----\n";
+	testProductRegistry();
+
+	std::cout << "\n---- Test versioned snapshots ----\n";
+	testVersionedSnapshots();
+
+	std::cout << "\n---- Test lifecycle engine ----\n";
+	testLifecycleEngine();
+
+	std::cout << "\n---- Test product query service ----\n";
+	testProductQueryService();
+
+	std::cout << "\n---- Test memory usage ----\n";
+	testMemoryUsage();
+
 	std::cout << "\n----------- Press Any key to quit! -------------\n" << std::endl;
 	std::cin.get();
 	return 0;
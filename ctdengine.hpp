@@ -0,0 +1,327 @@
+/**
+* ctdengine.hpp defines a cheapest-to-deliver (CTD) engine for BondFutures
+* whose deliverable baskets are owned by a BondProductService
+*/
+
+#ifndef CTDENGINE_HPP
+#define CTDENGINE_HPP
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "products.hpp"
+#include "productservice.hpp"
+
+/**
+* Basis analytics for one future x deliverable bond pair.
+* Prices are in points per 100 par, the implied repo is a decimal Act/360 rate.
+*/
+struct DeliverableAnalytics
+{
+	string futureId; // bond future product identifier
+	string bondId; // deliverable bond product identifier
+	double conversionFactor; // conversion factor of the bond into the future
+	double grossBasis; // clean bond price less futures price * conversion factor
+	double netBasis; // gross basis less carry to the delivery date
+	double impliedRepo; // return from buying the bond and delivering it into the future
+	bool cheapestToDeliver; // true for the deliverable with the highest implied repo of its future
+};
+
+// Cheapest pair index of a future without calculated pairs
+const size_t NO_PAIR = (size_t)-1;
+
+/**
+* Cheapest-to-deliver engine over a set of bond futures.
+* Conversion factors, accrued interest and coupon income only depend on reference data and are
+* computed once when a future is added, so each Calculate() is a flat pass over all future x
+* deliverable pairs using the latest futures and bond prices.
+*/
+class CheapestToDeliverEngine
+{
+public:
+	// CheapestToDeliverEngine ctor: positions settle on the settlement date and are financed at the repo rate (decimal, Act/360)
+	CheapestToDeliverEngine(BondProductService &_bondProductService, date _settlementDate, double _repoRate);
+
+	// Add a bond future at its quoted price, resolving its deliverable basket from the bond product service.
+	// Adding a future again reloads its delivery month and the reference data of its deliverables.
+	void AddFuture(const BondFuture &future);
+
+	// Set the price of a future in points (e.g. 158-15 is 158.46875)
+	void SetFuturePrice(const string &futureId, double price);
+
+	// Set the price of a future in ticks
+	void SetFuturePrice(const BondFuture &future, TickPrice price);
+
+	// Set the clean price of a deliverable bond in points
+	void SetBondPrice(const string &bondId, double price);
+
+	// Return the conversion factor of a bond into a future, computed on first use and cached afterwards
+	// by the terms it depends on: the contract's rounding rule, the delivery month, and the bond's maturity and coupon
+	double GetConversionFactor(const BondFuture &future, const Bond &bond);
+
+	// Recompute the basis and implied repo of every future x deliverable pair
+	const vector<DeliverableAnalytics>& Calculate();
+
+	// Return the cheapest-to-deliver analytics of a future as of the last Calculate()
+	const DeliverableAnalytics& GetCheapestToDeliver(const string &futureId) const;
+
+private:
+	// Reference data of a future x deliverable pair, fixed until the future is added again
+	struct DeliverablePair
+	{
+		size_t futureIndex; // index into futurePrices
+		size_t bondIndex; // index into bondPrices
+		double conversionFactor; // cached conversion factor
+		double accruedAtSettlement; // accrued interest of the bond on the settlement date
+		double accruedAtDelivery; // accrued interest of the bond on the delivery date
+		double couponIncome; // coupons paid between settlement and delivery
+		double days; // days from settlement to delivery
+	};
+
+	BondProductService &bondProductService; // owner of the deliverable bonds
+	date settlementDate; // settlement date of the cash bond leg
+	double repoRate; // financing rate
+
+	map<string, size_t> futureIndices; // future id -> index into futurePrices
+	map<string, size_t> bondIndices; // bond id -> index into bondPrices
+	vector<double> futurePrices; // latest futures prices
+	vector<double> bondPrices; // latest clean bond prices
+	vector<size_t> cheapestIndices; // future index -> index of its CTD pair in analytics, NO_PAIR until calculated
+	// (whole months, first delivery date, bond maturity, bond coupon) -> conversion factor
+	typedef tuple<bool, date, date, float> ConversionFactorKey;
+	map<ConversionFactorKey, double> conversionFactors;
+
+	vector<DeliverablePair> pairs; // pairs grouped by future
+	vector<DeliverableAnalytics> analytics; // results, parallel to pairs
+
+	// Return the index of an id, adding a slot for it when unknown
+	size_t GetIndex(map<string, size_t> &indices, vector<double> &prices, const string &id);
+
+	// Return the index of a future, adding its price and cheapest slots when unknown
+	size_t GetFutureIndex(const string &futureId);
+
+	// Return the accrued interest of a bond on a date, assuming semi-annual coupons rolled back from maturity
+	static double GetAccruedInterest(const Bond &bond, const date &asOf);
+
+	// Return the coupons paid by a bond in the period (from, to]
+	static double GetCouponIncome(const Bond &bond, const date &from, const date &to);
+};
+
+CheapestToDeliverEngine::CheapestToDeliverEngine(BondProductService &_bondProductService, date _settlementDate, double _repoRate)
+	: bondProductService(_bondProductService)
+{
+	settlementDate = _settlementDate;
+	repoRate = _repoRate;
+}
+
+void CheapestToDeliverEngine::AddFuture(const BondFuture &future)
+{
+	// resolve the whole basket before changing any state
+	const vector<string> &deliverableBondIds = future.GetDeliverableBondIds();
+	vector<const Bond*> deliverableBonds;
+	for (vector<string>::const_iterator it = deliverableBondIds.begin(); it != deliverableBondIds.end(); ++it)
+	{
+		const Bond *bond = bondProductService.Find(*it);
+		if (!bond)
+			throw "Deliverable bond not found";
+		deliverableBonds.push_back(bond);
+	}
+
+	size_t futureIndex = GetFutureIndex(future.GetProductId());
+	futurePrices[futureIndex] = future.ToPrice(future.GetPrice());
+
+	// drop the pairs of a future which is added again, keeping the remaining pairs grouped by future
+	// and the cheapest pair of every other future pointing at its new position
+	cheapestIndices[futureIndex] = NO_PAIR;
+	size_t kept = 0;
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		if (pairs[i].futureIndex == futureIndex)
+			continue;
+		if (cheapestIndices[pairs[i].futureIndex] == i)
+			cheapestIndices[pairs[i].futureIndex] = kept;
+		pairs[kept] = pairs[i];
+		analytics[kept] = analytics[i];
+		++kept;
+	}
+	pairs.resize(kept);
+	analytics.resize(kept);
+
+	date deliveryDate = future.GetMaturityDate();
+	for (size_t i = 0; i < deliverableBonds.size(); ++i)
+	{
+		const Bond &bond = *deliverableBonds[i];
+
+		DeliverablePair deliverablePair;
+		deliverablePair.futureIndex = futureIndex;
+		deliverablePair.bondIndex = GetIndex(bondIndices, bondPrices, deliverableBondIds[i]);
+		deliverablePair.conversionFactor = GetConversionFactor(future, bond);
+		deliverablePair.accruedAtSettlement = GetAccruedInterest(bond, settlementDate);
+		deliverablePair.accruedAtDelivery = GetAccruedInterest(bond, deliveryDate);
+		deliverablePair.couponIncome = GetCouponIncome(bond, settlementDate, deliveryDate);
+		deliverablePair.days = (double)(deliveryDate - settlementDate).days();
+		pairs.push_back(deliverablePair);
+
+		DeliverableAnalytics result = DeliverableAnalytics();
+		result.futureId = future.GetProductId();
+		result.bondId = deliverableBondIds[i];
+		result.conversionFactor = deliverablePair.conversionFactor;
+		analytics.push_back(result);
+	}
+}
+
+void CheapestToDeliverEngine::SetFuturePrice(const string &futureId, double price)
+{
+	futurePrices[GetFutureIndex(futureId)] = price;
+}
+
+void CheapestToDeliverEngine::SetFuturePrice(const BondFuture &future, TickPrice price)
+{
+	futurePrices[GetFutureIndex(future.GetProductId())] = future.ToPrice(price);
+}
+
+void CheapestToDeliverEngine::SetBondPrice(const string &bondId, double price)
+{
+	bondPrices[GetIndex(bondIndices, bondPrices, bondId)] = price;
+}
+
+double CheapestToDeliverEngine::GetConversionFactor(const BondFuture &future, const Bond &bond)
+{
+	// time to maturity is measured from the first day of the delivery month in whole years n and months z;
+	// z is rounded down to whole quarters, except for the 5Y (ZF) and 2Y (ZT) contracts which use whole months
+	bool wholeMonths = future.GetTicker() == "ZF" || future.GetTicker() == "ZT";
+	date firstDeliveryDate(future.GetMaturityDate().year(), future.GetMaturityDate().month(), 1);
+	date maturityDate = bond.GetMaturityDate();
+
+	ConversionFactorKey key(wholeMonths, firstDeliveryDate, maturityDate, bond.GetCoupon());
+	map<ConversionFactorKey, double>::iterator it = conversionFactors.find(key);
+	if (it != conversionFactors.end())
+		return it->second;
+
+	int months = (maturityDate.year() - firstDeliveryDate.year()) * 12 + (maturityDate.month() - firstDeliveryDate.month());
+	if (maturityDate.day() < firstDeliveryDate.day())
+		--months;
+	if (months < 0)
+		months = 0;
+
+	int n = months / 12;
+	int z = wholeMonths ? months % 12 : months % 12 / 3 * 3;
+	int v = z < 7 ? z : (wholeMonths ? z - 6 : 3);
+
+	// price per unit par of the bond at a 6% yield, rounded to four decimals
+	double coupon = bond.GetCoupon() / 100.0;
+	double a = 1.0 / pow(1.03, v / 6.0);
+	double b = coupon / 2.0 * (6 - v) / 6.0;
+	double c = z < 7 ? 1.0 / pow(1.03, 2.0 * n) : 1.0 / pow(1.03, 2.0 * n + 1.0);
+	double d = coupon / 0.06 * (1.0 - c);
+	double conversionFactor = floor((a * (coupon / 2.0 + c + d) - b) * 10000.0 + 0.5) / 10000.0;
+
+	conversionFactors.insert(make_pair(key, conversionFactor));
+	return conversionFactor;
+}
+
+const vector<DeliverableAnalytics>& CheapestToDeliverEngine::Calculate()
+{
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		const DeliverablePair &deliverablePair = pairs[i];
+		DeliverableAnalytics &result = analytics[i];
+
+		double futurePrice = futurePrices[deliverablePair.futureIndex];
+		double bondPrice = bondPrices[deliverablePair.bondIndex];
+		double dirtyPrice = bondPrice + deliverablePair.accruedAtSettlement;
+		double invoicePrice = futurePrice * deliverablePair.conversionFactor + deliverablePair.accruedAtDelivery;
+		double yearFraction = deliverablePair.days / 360.0;
+
+		// carry is the coupon income earned less the cost of financing the bond to delivery
+		double carry = deliverablePair.accruedAtDelivery + deliverablePair.couponIncome - deliverablePair.accruedAtSettlement - dirtyPrice * repoRate * yearFraction;
+
+		result.grossBasis = bondPrice - futurePrice * deliverablePair.conversionFactor;
+		result.netBasis = result.grossBasis - carry;
+		result.impliedRepo = dirtyPrice > 0 && yearFraction > 0 ? (invoicePrice + deliverablePair.couponIncome - dirtyPrice) / (dirtyPrice * yearFraction) : 0.0;
+		result.cheapestToDeliver = false;
+
+		size_t &cheapest = cheapestIndices[deliverablePair.futureIndex];
+		if (i == 0 || pairs[i - 1].futureIndex != deliverablePair.futureIndex || result.impliedRepo > analytics[cheapest].impliedRepo)
+			cheapest = i;
+	}
+
+	for (size_t i = 0; i < pairs.size(); ++i)
+		if (i == 0 || pairs[i - 1].futureIndex != pairs[i].futureIndex)
+			analytics[cheapestIndices[pairs[i].futureIndex]].cheapestToDeliver = true;
+
+	return analytics;
+}
+
+const DeliverableAnalytics& CheapestToDeliverEngine::GetCheapestToDeliver(const string &futureId) const
+{
+	// futures priced before they are added, or added again since the last Calculate(), have no result
+	map<string, size_t>::const_iterator it = futureIndices.find(futureId);
+	if (it == futureIndices.end() || cheapestIndices[it->second] >= analytics.size())
+		throw "Unknown bond future";
+
+	const DeliverableAnalytics &result = analytics[cheapestIndices[it->second]];
+	if (result.futureId != futureId)
+		throw "Unknown bond future";
+
+	return result;
+}
+
+size_t CheapestToDeliverEngine::GetIndex(map<string, size_t> &indices, vector<double> &prices, const string &id)
+{
+	map<string, size_t>::iterator it = indices.find(id);
+	if (it != indices.end())
+		return it->second;
+
+	indices.insert(make_pair(id, prices.size()));
+	prices.push_back(0.0);
+	return prices.size() - 1;
+}
+
+size_t CheapestToDeliverEngine::GetFutureIndex(const string &futureId)
+{
+	size_t futureIndex = GetIndex(futureIndices, futurePrices, futureId);
+	if (futureIndex == cheapestIndices.size())
+		cheapestIndices.push_back(NO_PAIR);
+	return futureIndex;
+}
+
+double CheapestToDeliverEngine::GetAccruedInterest(const Bond &bond, const date &asOf)
+{
+	date maturityDate = bond.GetMaturityDate();
+	if (asOf >= maturityDate)
+		return 0.0;
+
+	// roll back from maturity to the coupon period containing the date
+	date nextCouponDate = maturityDate;
+	date previousCouponDate = maturityDate - months(6);
+	for (int i = 1; previousCouponDate > asOf; ++i)
+	{
+		nextCouponDate = previousCouponDate;
+		previousCouponDate = maturityDate - months(6 * (i + 1));
+	}
+
+	double accruedDays = (double)(asOf - previousCouponDate).days();
+	double periodDays = (double)(nextCouponDate - previousCouponDate).days();
+	return bond.GetCoupon() / 2.0 * accruedDays / periodDays;
+}
+
+double CheapestToDeliverEngine::GetCouponIncome(const Bond &bond, const date &from, const date &to)
+{
+	double couponIncome = 0.0;
+	date maturityDate = bond.GetMaturityDate();
+	date couponDate = maturityDate;
+	for (int i = 1; couponDate > from; ++i)
+	{
+		if (couponDate <= to)
+			couponIncome += bond.GetCoupon() / 2.0;
+		couponDate = maturityDate - months(6 * i);
+	}
+
+	return couponIncome;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+* fixedstring.hpp defines a string stored inline in a fixed number of bytes, and the
+* product id and ticker fields built on it
+*/
+
+#ifndef FIXEDSTRING_HPP
+#define FIXEDSTRING_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/**
+* String of up to N - 1 characters held inline in N bytes: the characters, zero padded,
+* then the number of unused characters. That last byte is zero when the string is full, so
+* the characters are always null terminated. It owns no heap memory, so objects holding it
+* are trivially copyable and their size is their whole footprint. Assigning a longer string throws.
+* It reads like a const std::string (c_str, length, +, comparisons) and converts to one implicitly.
+*/
+template<size_t N>
+class FixedString
+{
+public:
+	static const size_t CAPACITY = N - 1; // most characters held
+
+	// FixedString ctors
+	FixedString() { Assign("", 0); }
+	FixedString(const string &value) { Assign(value.data(), value.size()); }
+	FixedString(const char *value) { Assign(value, strlen(value)); }
+
+	// Return true when a string fits inline
+	static bool Fits(const string &value) { return value.size() <= CAPACITY; }
+
+	// Return the characters, null terminated
+	const char* data() const { return chars; }
+	const char* c_str() const { return chars; }
+
+	// Return the number of characters
+	size_t size() const { return CAPACITY - (unsigned char)chars[CAPACITY]; }
+	size_t length() const { return size(); }
+
+	// Return true when there are no characters
+	bool empty() const { return size() == 0; }
+
+	// Return the characters as a std::string
+	string str() const { return string(chars, size()); }
+	operator string() const { return str(); }
+
+	// Compare with another string, as std::string::compare does
+	int compare(const char *otherChars, size_t otherLength) const
+	{
+		size_t length = size();
+		int result = memcmp(chars, otherChars, length < otherLength ? length : otherLength);
+		if (result != 0)
+			return result;
+		return length < otherLength ? -1 : (length > otherLength ? 1 : 0);
+	}
+	int compare(const FixedString &other) const { return compare(other.chars, other.size()); }
+	int compare(const string &other) const { return compare(other.data(), other.size()); }
+
+	// Return a hash of the characters (FNV-1a)
+	size_t GetHash() const
+	{
+		size_t hash = 2166136261u;
+		for (size_t i = 0, length = size(); i < length; ++i)
+			hash = (hash ^ (unsigned char)chars[i]) * 16777619u;
+		return hash;
+	}
+
+private:
+	char chars[N]; // characters, zero padded, then the number of unused characters
+
+	// Copy characters in, zero padding the rest
+	void Assign(const char *value, size_t valueLength)
+	{
+		if (valueLength > CAPACITY)
+			throw "String too long for its fixed field";
+
+		memcpy(chars, value, valueLength);
+		memset(chars + valueLength, 0, CAPACITY - valueLength);
+		chars[CAPACITY] = (char)(CAPACITY - valueLength);
+	}
+};
+
+template<size_t N>
+bool operator==(const FixedString<N> &left, const FixedString<N> &right) { return left.compare(right) == 0; }
+
+template<size_t N>
+bool operator!=(const FixedString<N> &left, const FixedString<N> &right) { return left.compare(right) != 0; }
+
+template<size_t N>
+bool operator<(const FixedString<N> &left, const FixedString<N> &right) { return left.compare(right) < 0; }
+
+template<size_t N>
+bool operator==(const FixedString<N> &left, const string &right) { return left.compare(right) == 0; }
+
+template<size_t N>
+bool operator==(const string &left, const FixedString<N> &right) { return right.compare(left) == 0; }
+
+template<size_t N>
+bool operator!=(const FixedString<N> &left, const string &right) { return left.compare(right) != 0; }
+
+template<size_t N>
+bool operator!=(const string &left, const FixedString<N> &right) { return right.compare(left) != 0; }
+
+template<size_t N>
+bool operator<(const FixedString<N> &left, const string &right) { return left.compare(right) < 0; }
+
+template<size_t N>
+bool operator<(const string &left, const FixedString<N> &right) { return right.compare(left) > 0; }
+
+template<size_t N>
+bool operator==(const FixedString<N> &left, const char *right) { return left.compare(right, strlen(right)) == 0; }
+
+template<size_t N>
+bool operator!=(const FixedString<N> &left, const char *right) { return left.compare(right, strlen(right)) != 0; }
+
+template<size_t N>
+string operator+(const FixedString<N> &left, const string &right) { return left.str().append(right); }
+
+template<size_t N>
+string operator+(const string &left, const FixedString<N> &right) { return string(left).append(right.data(), right.size()); }
+
+template<size_t N>
+string operator+(const FixedString<N> &left, const char *right) { return left.str().append(right); }
+
+template<size_t N>
+string operator+(const char *left, const FixedString<N> &right) { return string(left).append(right.data(), right.size()); }
+
+template<size_t N>
+string operator+(const FixedString<N> &left, char right) { return left.str().append(1, right); }
+
+template<size_t N>
+ostream& operator<<(ostream &output, const FixedString<N> &value)
+{
+	output.write(value.data(), value.size());
+	return output;
+}
+
+namespace std
+{
+	template<size_t N>
+	struct hash<FixedString<N> >
+	{
+		size_t operator()(const FixedString<N> &value) const { return value.GetHash(); }
+	};
+}
+
+// Product identifier of up to 23 characters, e.g. a 9-character CUSIP or a 12-character ISIN
+typedef FixedString<24> ProductId;
+
+// Exchange ticker of up to 7 characters
+typedef FixedString<8> Ticker;
+
+#endif
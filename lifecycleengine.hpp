@@ -0,0 +1,268 @@
+/**
+* lifecycleengine.hpp defines a ProductLifecycleEngine retiring matured bonds, terminated
+* swaps and expired futures from the product services into a cold archive
+*/
+
+#ifndef LIFECYCLEENGINE_HPP
+#define LIFECYCLEENGINE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "products.hpp"
+#include "productregistry.hpp"
+
+#include "boost/date_time/gregorian/gregorian.hpp"
+
+using namespace std;
+using namespace boost::gregorian;
+
+/**
+* Lifecycle engine over a ProductRegistry.
+* Every tracked product is scheduled on a timer wheel keyed by the business date after its
+* maturity, termination or expiry date: one bucket per day over a horizon of wheelDays, and an
+* ordered overflow for later dates which is drained into the wheel as the horizon advances.
+* Rolling the business date visits only the buckets of the days rolled over and the products
+* expiring on them, which are removed from their service and registry and moved to the archive.
+* Roll() cost is O(expiring products + days rolled), independent of the number of live products.
+*/
+class ProductLifecycleEngine
+{
+public:
+	// ProductLifecycleEngine ctor
+	ProductLifecycleEngine(ProductRegistry &_registry, date _businessDate, size_t _wheelDays = 1024);
+
+	// Add a product through the registry and track it
+	ProductHandle Add(const Bond &bond);
+	ProductHandle Add(const IRSwap &swap);
+	ProductHandle Add(const Future &future);
+
+	// Track a product already held by a service. A product whose date is already past is
+	// archived at once; a product tracked again after a date change keeps only its latest date.
+	void Track(const string &productId);
+
+	// Roll to a new business date, archiving every product with a date before it, and return
+	// the number of products archived
+	size_t Roll(date newBusinessDate);
+
+	// Return the current business date
+	date GetBusinessDate() const;
+
+	// Return the number of pending retirements, including those of products removed or rescheduled since
+	size_t GetTrackedCount() const;
+
+	// Return the archived products, keyed by product id
+	const map<string, Bond>& GetArchivedBonds() const;
+	const map<string, IRSwap>& GetArchivedSwaps() const;
+	const map<string, Future>& GetArchivedFutures() const;
+
+private:
+	// Scheduled retirement of a product
+	struct Timer
+	{
+		string productId; // product to retire
+		ProductType productType; // type of the product
+		date expiryDate; // last live date of the product when scheduled
+	};
+
+	ProductRegistry &registry;
+	date businessDate; // current business date
+	vector<vector<Timer> > wheel; // timers due within the horizon, by day number modulo the wheel size
+	multimap<date, Timer> overflow; // timers due beyond the horizon, by retirement date
+	size_t trackedCount; // timers pending on the wheel and in the overflow
+
+	map<string, Bond> archivedBonds; // cold tier of matured bonds
+	map<string, IRSwap> archivedSwaps; // cold tier of terminated swaps
+	map<string, Future> archivedFutures; // cold tier of expired futures
+
+	// Schedule a timer on the wheel or in the overflow, or retire the product when already due
+	void Schedule(const Timer &timer);
+
+	// Return the last live date of a product
+	date GetExpiryDate(ProductHandle handle) const;
+
+	// Move a product to the archive unless it has been removed or rescheduled since, returning true when moved
+	bool Retire(const Timer &timer);
+
+	// Return the wheel bucket of a date
+	vector<Timer>& GetBucket(date retireDate);
+};
+
+ProductLifecycleEngine::ProductLifecycleEngine(ProductRegistry &_registry, date _businessDate, size_t _wheelDays)
+	: registry(_registry), businessDate(_businessDate), wheel(_wheelDays == 0 ? 1 : _wheelDays), trackedCount(0)
+{
+}
+
+ProductHandle ProductLifecycleEngine::Add(const Bond &bond)
+{
+	ProductHandle handle = registry.Add(bond);
+	Track(bond.GetProductId());
+	return handle;
+}
+
+ProductHandle ProductLifecycleEngine::Add(const IRSwap &swap)
+{
+	ProductHandle handle = registry.Add(swap);
+	Track(swap.GetProductId());
+	return handle;
+}
+
+ProductHandle ProductLifecycleEngine::Add(const Future &future)
+{
+	ProductHandle handle = registry.Add(future);
+	Track(future.GetProductId());
+	return handle;
+}
+
+void ProductLifecycleEngine::Track(const string &productId)
+{
+	ProductHandle handle = registry.Resolve(productId);
+
+	Timer timer;
+	timer.productId = productId;
+	timer.productType = registry.GetProductType(handle);
+	timer.expiryDate = GetExpiryDate(handle);
+	Schedule(timer);
+}
+
+size_t ProductLifecycleEngine::Roll(date newBusinessDate)
+{
+	if (newBusinessDate <= businessDate)
+		return 0;
+
+	size_t archived = 0;
+	registry.BeginBatch();
+
+	// every timer on the wheel is due within the horizon, so one turn covers any longer roll
+	long days = (newBusinessDate - businessDate).days();
+	if (days > (long)wheel.size())
+		days = (long)wheel.size();
+
+	for (long i = 1; i <= days; ++i)
+	{
+		vector<Timer> &bucket = GetBucket(businessDate + date_duration(i));
+		for (size_t j = 0; j < bucket.size(); ++j)
+		{
+			if (Retire(bucket[j]))
+				++archived;
+		}
+		trackedCount -= bucket.size();
+		bucket.clear();
+	}
+
+	businessDate = newBusinessDate;
+
+	// move the timers now within the horizon from the overflow to the wheel
+	date horizon = businessDate + date_duration((long)wheel.size());
+	while (!overflow.empty() && overflow.begin()->first <= horizon)
+	{
+		multimap<date, Timer>::iterator it = overflow.begin();
+		if (it->first <= businessDate)
+		{
+			if (Retire(it->second))
+				++archived;
+			--trackedCount;
+		}
+		else
+		{
+			GetBucket(it->first).push_back(it->second);
+		}
+		overflow.erase(it);
+	}
+
+	registry.EndBatch();
+	return archived;
+}
+
+date ProductLifecycleEngine::GetBusinessDate() const
+{
+	return businessDate;
+}
+
+size_t ProductLifecycleEngine::GetTrackedCount() const
+{
+	return trackedCount;
+}
+
+const map<string, Bond>& ProductLifecycleEngine::GetArchivedBonds() const
+{
+	return archivedBonds;
+}
+
+const map<string, IRSwap>& ProductLifecycleEngine::GetArchivedSwaps() const
+{
+	return archivedSwaps;
+}
+
+const map<string, Future>& ProductLifecycleEngine::GetArchivedFutures() const
+{
+	return archivedFutures;
+}
+
+void ProductLifecycleEngine::Schedule(const Timer &timer)
+{
+	// products stay live through their date and retire on the next business date roll
+	date retireDate = timer.expiryDate + date_duration(1);
+	if (retireDate <= businessDate)
+	{
+		Retire(timer);
+		return;
+	}
+
+	if (retireDate <= businessDate + date_duration((long)wheel.size()))
+		GetBucket(retireDate).push_back(timer);
+	else
+		overflow.insert(make_pair(retireDate, timer));
+	++trackedCount;
+}
+
+date ProductLifecycleEngine::GetExpiryDate(ProductHandle handle) const
+{
+	switch (registry.GetProductType(handle))
+	{
+	case BOND:
+		return registry.GetBond(handle).GetMaturityDate();
+	case IRSWAP:
+		return registry.GetSwap(handle).GetTerminationDate();
+	default:
+		return registry.GetFuture(handle).GetMaturityDate();
+	}
+}
+
+bool ProductLifecycleEngine::Retire(const Timer &timer)
+{
+	ProductHandle handle;
+	if (!registry.TryResolve(timer.productId, handle) || registry.GetProductType(handle) != timer.productType)
+		return false;
+
+	// a product replaced with a later date has its own timer
+	if (GetExpiryDate(handle) != timer.expiryDate)
+		return false;
+
+	// a product archived before under the same id is superseded
+	switch (timer.productType)
+	{
+	case BOND:
+		archivedBonds.erase(timer.productId);
+		archivedBonds.insert(make_pair(timer.productId, registry.GetBond(handle)));
+		break;
+	case IRSWAP:
+		archivedSwaps.erase(timer.productId);
+		archivedSwaps.insert(make_pair(timer.productId, registry.GetSwap(handle)));
+		break;
+	default:
+		archivedFutures.erase(timer.productId);
+		archivedFutures.insert(make_pair(timer.productId, registry.GetFuture(handle)));
+		break;
+	}
+
+	registry.Remove(timer.productId);
+	return true;
+}
+
+vector<ProductLifecycleEngine::Timer>& ProductLifecycleEngine::GetBucket(date retireDate)
+{
+	return wheel[(size_t)retireDate.day_number() % wheel.size()];
+}
+
+#endif
@@ -0,0 +1,37 @@
+/**
+* memoryusage.hpp defines the memory footprint reported by the product services
+* and indexes
+*/
+
+#ifndef MEMORYUSAGE_HPP
+#define MEMORYUSAGE_HPP
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+/**
+* Memory footprint of a product store or index
+*/
+struct MemoryUsage
+{
+	size_t count; // number of products or index entries
+	size_t payloadBytes; // bytes of the products, including the heap storage of their strings
+	size_t indexBytes; // bytes of the structure over them: tree nodes, buckets, handle slots
+	size_t reservedBytes; // bytes held in pool chunks, in use or free
+
+	MemoryUsage() : count(0), payloadBytes(0), indexBytes(0), reservedBytes(0) {}
+
+	// Return the payload and index bytes per product or entry
+	double GetBytesPerEntry() const { return count == 0 ? 0.0 : (double)(payloadBytes + indexBytes) / count; }
+};
+
+// Return the heap bytes of a string, 0 when its characters are stored inline (short string optimization)
+inline size_t GetStringHeapBytes(const string &value)
+{
+	static const size_t inlineCapacity = string().capacity();
+	return value.capacity() > inlineCapacity ? value.capacity() + 1 : 0;
+}
+
+#endif
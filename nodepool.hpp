@@ -0,0 +1,301 @@
+/**
+* nodepool.hpp defines a pool for the fixed size nodes of the product service
+* containers, and STL allocators over it
+*/
+
+#ifndef NODEPOOL_HPP
+#define NODEPOOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/**
+* Pool of small memory blocks carved from large chunks.
+* Freed blocks are kept on a free list per 16-byte size class and reused; chunks grow
+* geometrically, so loading n nodes takes O(log n) chunk allocations, or one after Reserve().
+* Blocks larger than the biggest size class go straight to operator new.
+* Blocks may be freed from any thread, e.g. when a reader drops the last reference to a shared node.
+*/
+class NodePool
+{
+public:
+	// NodePool ctor
+	explicit NodePool(size_t _initialChunkSize = 64 * 1024);
+
+	// Release all chunks
+	~NodePool();
+
+	// Allocate a block of the given size
+	void* Allocate(size_t bytes);
+
+	// Return a block to the pool
+	void Deallocate(void *block, size_t bytes);
+
+	// Make sure the next allocations of up to bytes in total need no new chunk
+	void Reserve(size_t bytes);
+
+	// Release every block at once, keeping the largest chunk for reuse.
+	// All memory handed out by the pool becomes invalid.
+	void Reset();
+
+	// Return the number of chunks currently held
+	size_t GetChunkCount() const;
+
+	// Return the number of bytes held in chunks
+	size_t GetBytesReserved() const;
+
+	// Return the bytes taken by a block of the given size, including its rounding to a size class
+	static size_t GetBlockSize(size_t bytes);
+
+private:
+	static const size_t ALIGNMENT = 16; // block alignment and size class granularity
+	static const size_t SIZE_CLASSES = 32; // size classes up to 512 bytes
+
+	struct FreeBlock
+	{
+		FreeBlock *next;
+	};
+
+	vector<char*> chunks; // chunks, in allocation order
+	vector<size_t> chunkSizes; // size of each chunk
+	char *current; // next free byte of the last chunk
+	size_t remaining; // free bytes left in the last chunk
+	size_t nextChunkSize; // size of the next chunk
+	FreeBlock *freeLists[SIZE_CLASSES]; // free blocks per size class
+	mutex poolMutex; // guards the chunks and free lists
+
+	NodePool(const NodePool&);
+	NodePool& operator=(const NodePool&);
+
+	// Add a chunk of at least the given size
+	void AddChunk(size_t bytes);
+};
+
+/**
+* STL allocator drawing single objects from a NodePool, as node based containers do.
+* Arrays fall back to operator new.
+*/
+template<typename T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef PoolAllocator<U> other;
+	};
+
+	// PoolAllocator ctor
+	explicit PoolAllocator(NodePool *_pool) : pool(_pool) {}
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U> &other) : pool(other.GetPool()) {}
+
+	T* allocate(size_t n)
+	{
+		if (n == 1)
+			return static_cast<T*>(pool->Allocate(sizeof(T)));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+		if (n == 1)
+			pool->Deallocate(p, sizeof(T));
+		else
+			::operator delete(p);
+	}
+
+	// Return the pool
+	NodePool* GetPool() const { return pool; }
+
+	template<typename U>
+	bool operator==(const PoolAllocator<U> &other) const { return pool == other.GetPool(); }
+
+	template<typename U>
+	bool operator!=(const PoolAllocator<U> &other) const { return pool != other.GetPool(); }
+
+private:
+	NodePool *pool; // pool to draw from
+};
+
+/**
+* STL allocator drawing single objects from a NodePool it shares ownership of.
+* Every object allocated with it keeps the pool alive through its allocator copy, so objects
+* which outlive their owner (e.g. versions pinned by a snapshot) stay valid. Arrays fall back to operator new.
+*/
+template<typename T>
+class SharedPoolAllocator
+{
+public:
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef SharedPoolAllocator<U> other;
+	};
+
+	// SharedPoolAllocator ctor
+	explicit SharedPoolAllocator(const shared_ptr<NodePool> &_pool) : pool(_pool) {}
+
+	template<typename U>
+	SharedPoolAllocator(const SharedPoolAllocator<U> &other) : pool(other.GetPool()) {}
+
+	T* allocate(size_t n)
+	{
+		if (n == 1)
+			return static_cast<T*>(pool->Allocate(sizeof(T)));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+		if (n == 1)
+			pool->Deallocate(p, sizeof(T));
+		else
+			::operator delete(p);
+	}
+
+	// Return the pool
+	const shared_ptr<NodePool>& GetPool() const { return pool; }
+
+	template<typename U>
+	bool operator==(const SharedPoolAllocator<U> &other) const { return pool == other.GetPool(); }
+
+	template<typename U>
+	bool operator!=(const SharedPoolAllocator<U> &other) const { return pool != other.GetPool(); }
+
+private:
+	shared_ptr<NodePool> pool; // pool to draw from, shared with the other allocations
+};
+
+NodePool::NodePool(size_t _initialChunkSize)
+{
+	current = 0;
+	remaining = 0;
+	nextChunkSize = _initialChunkSize;
+	if (nextChunkSize < ALIGNMENT)
+		nextChunkSize = ALIGNMENT;
+	for (size_t i = 0; i < SIZE_CLASSES; ++i)
+		freeLists[i] = 0;
+}
+
+NodePool::~NodePool()
+{
+	for (size_t i = 0; i < chunks.size(); ++i)
+		::operator delete(chunks[i]);
+}
+
+void* NodePool::Allocate(size_t bytes)
+{
+	size_t sizeClass = (bytes + ALIGNMENT - 1) / ALIGNMENT;
+	if (sizeClass == 0 || sizeClass > SIZE_CLASSES)
+		return ::operator new(bytes);
+
+	lock_guard<mutex> lock(poolMutex);
+	FreeBlock *&freeList = freeLists[sizeClass - 1];
+	if (freeList)
+	{
+		FreeBlock *block = freeList;
+		freeList = block->next;
+		return block;
+	}
+
+	size_t blockSize = sizeClass * ALIGNMENT;
+	if (remaining < blockSize)
+		AddChunk(blockSize);
+
+	void *block = current;
+	current += blockSize;
+	remaining -= blockSize;
+	return block;
+}
+
+void NodePool::Deallocate(void *block, size_t bytes)
+{
+	size_t sizeClass = (bytes + ALIGNMENT - 1) / ALIGNMENT;
+	if (sizeClass == 0 || sizeClass > SIZE_CLASSES)
+	{
+		::operator delete(block);
+		return;
+	}
+
+	lock_guard<mutex> lock(poolMutex);
+	FreeBlock *freeBlock = static_cast<FreeBlock*>(block);
+	freeBlock->next = freeLists[sizeClass - 1];
+	freeLists[sizeClass - 1] = freeBlock;
+}
+
+void NodePool::Reserve(size_t bytes)
+{
+	lock_guard<mutex> lock(poolMutex);
+	if (remaining < bytes)
+		AddChunk(bytes);
+}
+
+void NodePool::Reset()
+{
+	lock_guard<mutex> lock(poolMutex);
+	for (size_t i = 0; i < SIZE_CLASSES; ++i)
+		freeLists[i] = 0;
+
+	if (chunks.empty())
+		return;
+
+	// chunks only grow, so the last one is the largest
+	for (size_t i = 0; i + 1 < chunks.size(); ++i)
+		::operator delete(chunks[i]);
+
+	chunks[0] = chunks.back();
+	chunkSizes[0] = chunkSizes.back();
+	chunks.resize(1);
+	chunkSizes.resize(1);
+	current = chunks[0];
+	remaining = chunkSizes[0];
+}
+
+size_t NodePool::GetChunkCount() const
+{
+	return chunks.size();
+}
+
+size_t NodePool::GetBytesReserved() const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < chunkSizes.size(); ++i)
+		bytes += chunkSizes[i];
+	return bytes;
+}
+
+size_t NodePool::GetBlockSize(size_t bytes)
+{
+	size_t sizeClass = (bytes + ALIGNMENT - 1) / ALIGNMENT;
+	if (sizeClass == 0 || sizeClass > SIZE_CLASSES)
+		return bytes;
+
+	return sizeClass * ALIGNMENT;
+}
+
+void NodePool::AddChunk(size_t bytes)
+{
+	size_t chunkSize = nextChunkSize;
+	while (chunkSize < bytes)
+		chunkSize *= 2;
+	nextChunkSize = chunkSize * 2;
+
+	// the tail of the previous chunk is abandoned
+	current = static_cast<char*>(::operator new(chunkSize));
+	remaining = chunkSize;
+	chunks.push_back(current);
+	chunkSizes.push_back(chunkSize);
+}
+
+#endif
@@ -0,0 +1,214 @@
+/**
+* price.hpp defines an integer tick-count price for futures, with a parser
+* and formatter for treasury 32nds price quotes (e.g. "158-15", "131-165", "131-16+")
+*/
+
+#ifndef PRICE_HPP
+#define PRICE_HPP
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+* Price of a future as a whole number of ticks of the future's tick size.
+* Comparison and arithmetic are integer operations, prices of different futures are
+* only comparable when they share a tick size.
+*/
+class TickPrice
+{
+public:
+	// TickPrice ctor
+	TickPrice() : ticks(0) {}
+	explicit TickPrice(long long _ticks) : ticks(_ticks) {}
+
+	// Return the number of ticks
+	long long GetTicks() const { return ticks; }
+
+	// Return the price in points for the given tick size
+	double ToDouble(double tickSize) const { return ticks * tickSize; }
+
+	// Return the nearest tick price of a price in points
+	static TickPrice FromDouble(double price, double tickSize) { return TickPrice(llround(price / tickSize)); }
+
+	bool operator==(const TickPrice &other) const { return ticks == other.ticks; }
+	bool operator!=(const TickPrice &other) const { return ticks != other.ticks; }
+	bool operator<(const TickPrice &other) const { return ticks < other.ticks; }
+	bool operator<=(const TickPrice &other) const { return ticks <= other.ticks; }
+	bool operator>(const TickPrice &other) const { return ticks > other.ticks; }
+	bool operator>=(const TickPrice &other) const { return ticks >= other.ticks; }
+	TickPrice operator+(const TickPrice &other) const { return TickPrice(ticks + other.ticks); }
+	TickPrice operator-(const TickPrice &other) const { return TickPrice(ticks - other.ticks); }
+
+private:
+	long long ticks; // price in ticks
+};
+
+// Treasury quotes are decoded to 256ths of a point: 32nds of a point and eighths of a 32nd
+const int TREASURY_UNITS_PER_POINT = 256;
+
+// Trailing fraction of a 32nd in eighths, -1 for an invalid character.
+// '+' (half), '2' (quarter), '5' (half) and '7' (three quarters) are the usual ones, '\0' means no fraction.
+const signed char TREASURY_FRACTION_EIGHTHS[256] = {
+	0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, -1, -1, -1, -1,
+	0, 1, 2, 3, -1, 4, 5, 6, 7, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Characters of the fraction of a 32nd in eighths, with and without '+' for a half
+const char TREASURY_FRACTION_CHARS[2][8] = { { '0', '1', '2', '3', '5', '6', '7', '8' }, { '0', '1', '2', '3', '+', '6', '7', '8' } };
+
+// Decode a treasury quote "[-]H-TT[F]" with a handle of 1 to 17 digits into 256ths of a point,
+// reading back every quote FormatTreasuryQuote() writes. The separator is found from the length
+// and there is no branching on the characters; invalid quotes set invalid to true.
+long long DecodeTreasuryQuote(const char *quote, size_t length, bool &invalid);
+
+// Parse a treasury quote into a tick price of the given tick size (e.g. 1/32 for ZB, 1/64 for ZN).
+// Quotes between two ticks (e.g. "158-16+" for a 1/32 tick) are invalid rather than rounded.
+TickPrice ParseTreasuryQuote(const string &quote, double tickSize);
+
+// Parse a batch of treasury quotes into tick prices of the given tick size
+void ParseTreasuryQuotes(const vector<string> &quotes, double tickSize, vector<TickPrice> &prices);
+
+// Return the tick count of a decoded quote in ticks, setting invalid when it is not a whole number of ticks
+long long TreasuryUnitsToTicks(long long units, double ticksPerUnit, bool &invalid);
+
+// Size of a buffer holding any formatted treasury quote: sign, 19 handle digits, "-TTF" and '\0'
+const size_t TREASURY_QUOTE_BUFFER_SIZE = 25;
+
+// Format a tick price as a treasury quote into buffer (at least TREASURY_QUOTE_BUFFER_SIZE chars), returning its length.
+// Handles of any length are written in full, negative prices (spreads, basis) with a leading '-', e.g. "-0-16".
+// Halves of a 32nd are written as '+' when plusForHalf is set and as '5' otherwise.
+size_t FormatTreasuryQuote(TickPrice price, double tickSize, char *buffer, bool plusForHalf);
+
+// Format a tick price as a treasury quote
+string FormatTreasuryQuote(TickPrice price, double tickSize);
+
+long long DecodeTreasuryQuote(const char *quote, size_t length, bool &invalid)
+{
+	// largest handle whose quotes fit in a long long of 256ths
+	const unsigned long long maxHandle = 36028797018963967ULL;
+
+	// copy into a zero padded window so every read below stays in bounds
+	char window[TREASURY_QUOTE_BUFFER_SIZE + 1] = { 0 };
+	size_t copied = length < TREASURY_QUOTE_BUFFER_SIZE ? length : TREASURY_QUOTE_BUFFER_SIZE;
+	memcpy(window, quote, copied);
+
+	// optional sign, then the '-' separating the handle from "TT" or "TTF" at the end
+	size_t negative = window[0] == '-';
+	size_t end = copied < 4 ? 4 : copied;
+	size_t dash = end - 3 - (window[end - 4] == '-');
+
+	unsigned long long handle = 0;
+	unsigned badDigits = 0;
+	for (size_t i = negative; i < dash; ++i)
+	{
+		unsigned digit = (unsigned char)window[i] - '0';
+		badDigits |= digit > 9;
+		handle = handle * 10 + digit;
+	}
+
+	unsigned t0 = (unsigned char)window[dash + 1] - '0';
+	unsigned t1 = (unsigned char)window[dash + 2] - '0';
+	unsigned thirtySeconds = t0 * 10 + t1;
+	int eighths = TREASURY_FRACTION_EIGHTHS[(unsigned char)window[dash + 3]];
+
+	invalid = invalid | (dash <= negative) | (dash - negative > 17) | (window[dash] != '-') | (length < dash + 3) | (length > dash + 4)
+		| (badDigits != 0) | (handle > maxHandle) | (t0 > 9) | (t1 > 9) | (thirtySeconds > 31) | (eighths < 0);
+
+	long long units = (long long)(((handle & maxHandle) * 32 + thirtySeconds % 32) * 8 + (eighths & 7));
+	return negative ? -units : units;
+}
+
+TickPrice ParseTreasuryQuote(const string &quote, double tickSize)
+{
+	bool invalid = false;
+	long long units = DecodeTreasuryQuote(quote.c_str(), quote.size(), invalid);
+	if (invalid)
+		throw "Invalid treasury price quote";
+
+	long long ticks = TreasuryUnitsToTicks(units, 1.0 / (tickSize * TREASURY_UNITS_PER_POINT), invalid);
+	if (invalid)
+		throw "Treasury price quote is not a whole number of ticks";
+
+	return TickPrice(ticks);
+}
+
+void ParseTreasuryQuotes(const vector<string> &quotes, double tickSize, vector<TickPrice> &prices)
+{
+	double ticksPerUnit = 1.0 / (tickSize * TREASURY_UNITS_PER_POINT);
+	bool invalid = false;
+
+	prices.resize(quotes.size());
+	for (size_t i = 0; i < quotes.size(); ++i)
+		prices[i] = TickPrice(TreasuryUnitsToTicks(DecodeTreasuryQuote(quotes[i].c_str(), quotes[i].size(), invalid), ticksPerUnit, invalid));
+
+	if (invalid)
+		throw "Invalid treasury price quote";
+}
+
+long long TreasuryUnitsToTicks(long long units, double ticksPerUnit, bool &invalid)
+{
+	double ticks = units * ticksPerUnit;
+	long long wholeTicks = llround(ticks);
+
+	// binary tick sizes (1/32, 1/64, 1/128) give exact results; the tolerance covers any others
+	invalid = invalid | (fabs(ticks - (double)wholeTicks) > 1e-6);
+	return wholeTicks;
+}
+
+size_t FormatTreasuryQuote(TickPrice price, double tickSize, char *buffer, bool plusForHalf)
+{
+	long long units = llround(price.GetTicks() * tickSize * TREASURY_UNITS_PER_POINT);
+	size_t negative = units < 0;
+	unsigned long long magnitude = negative ? 0ULL - (unsigned long long)units : (unsigned long long)units;
+	unsigned long long handle = magnitude / 256;
+	unsigned thirtySeconds = (unsigned)(magnitude / 8 % 32);
+	unsigned eighths = (unsigned)(magnitude % 8);
+
+	// sign, then the handle digits right aligned in a scratch buffer and copied
+	buffer[0] = '-';
+	char digits[20];
+	size_t handleLength = 0;
+	do
+	{
+		digits[19 - handleLength++] = (char)('0' + handle % 10);
+		handle /= 10;
+	} while (handle != 0);
+	memcpy(buffer + negative, digits + 20 - handleLength, handleLength);
+
+	char *fraction = buffer + negative + handleLength;
+	fraction[0] = '-';
+	fraction[1] = (char)('0' + thirtySeconds / 10);
+	fraction[2] = (char)('0' + thirtySeconds % 10);
+	fraction[3] = TREASURY_FRACTION_CHARS[plusForHalf][eighths];
+
+	size_t length = negative + handleLength + 3 + (eighths != 0);
+	buffer[length] = '\0';
+	return length;
+}
+
+string FormatTreasuryQuote(TickPrice price, double tickSize)
+{
+	char buffer[TREASURY_QUOTE_BUFFER_SIZE];
+	size_t length = FormatTreasuryQuote(price, tickSize, buffer, true);
+	return string(buffer, length);
+}
+
+#endif
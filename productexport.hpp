@@ -0,0 +1,365 @@
+/**
+* productexport.hpp defines a reusable buffer for bulk export of products
+* as CSV or JSON lines
+*/
+
+#ifndef PRODUCTEXPORT_HPP
+#define PRODUCTEXPORT_HPP
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/gregorian/gregorian.hpp"
+#include "fixedstring.hpp"
+
+using namespace std;
+using namespace boost::gregorian;
+
+// Export formats: CSV with a header line, or one JSON object per line
+enum ExportFormat { CSV, JSON_LINES };
+
+/**
+* Export buffer over a file.
+* Records are formatted in place into a buffer allocated once, which is written to the file
+* in large sequential blocks whenever it fills up. Formatting a record makes no heap allocation.
+* A failed or short write (e.g. a full disk) throws from the call which triggered it and marks
+* the buffer failed; the destructor cannot throw, so callers Flush() before it to see the last write.
+*/
+class ExportBuffer
+{
+public:
+	// ExportBuffer ctor: the file must be open for writing and outlive the buffer
+	ExportBuffer(FILE *_file, ExportFormat _format, size_t _capacity = 1 << 20);
+
+	// Flush the remaining records on destruction, ignoring write failures
+	~ExportBuffer();
+
+	// Return the export format
+	ExportFormat GetFormat() const;
+
+	// Write the CSV header line of a record type (nothing for JSON lines)
+	void AddHeader(const char* const *fieldNames, size_t fieldCount);
+
+	// Start a new record
+	void BeginRecord();
+
+	// Add a field to the current record
+	void AddField(const char *name, const char *value);
+	void AddField(const char *name, const string &value);
+	template<size_t N>
+	void AddField(const char *name, const FixedString<N> &value);
+	void AddField(const char *name, long long value);
+	void AddField(const char *name, double value, int decimals);
+	void AddField(const char *name, const date &value);
+
+	// Finish the current record
+	void EndRecord();
+
+	// Write the buffered records to the file, throwing when the write fails
+	void Flush();
+
+	// Return the number of records exported so far
+	size_t GetRecordCount() const;
+
+	// Return true once a write has failed; the file is then incomplete
+	bool HasFailed() const;
+
+private:
+	FILE *file; // output file
+	ExportFormat format; // output format
+	vector<char> buffer; // formatting buffer
+	size_t size; // bytes used in the buffer
+	size_t recordCount; // records exported
+	bool firstField; // true until the first field of the current record
+	bool failed; // true once a write has failed
+
+	// Make room for at least count more bytes, flushing if needed
+	void Reserve(size_t count);
+
+	// Append raw bytes
+	void Append(const char *data, size_t length);
+	void Append(char c);
+
+	// Append the separator and (for JSON) the name of the next field
+	void BeginField(const char *name);
+
+	// Write bytes to the file, throwing when the write fails
+	void Write(const char *data, size_t length);
+
+	// Append a string value, quoted when needed for CSV, quoted and escaped for JSON
+	void AppendString(const char *value, size_t length);
+
+	// Append a signed integer
+	void AppendInteger(long long value);
+};
+
+ExportBuffer::ExportBuffer(FILE *_file, ExportFormat _format, size_t _capacity)
+{
+	file = _file;
+	format = _format;
+	buffer.resize(_capacity < 256 ? 256 : _capacity);
+	size = 0;
+	recordCount = 0;
+	firstField = true;
+	failed = false;
+}
+
+ExportBuffer::~ExportBuffer()
+{
+	try
+	{
+		Flush();
+	}
+	catch (...)
+	{
+	}
+}
+
+ExportFormat ExportBuffer::GetFormat() const
+{
+	return format;
+}
+
+void ExportBuffer::AddHeader(const char* const *fieldNames, size_t fieldCount)
+{
+	if (format != CSV)
+		return;
+
+	for (size_t i = 0; i < fieldCount; ++i)
+	{
+		if (i > 0)
+			Append(',');
+		Append(fieldNames[i], strlen(fieldNames[i]));
+	}
+	Append('\n');
+}
+
+void ExportBuffer::BeginRecord()
+{
+	firstField = true;
+	if (format == JSON_LINES)
+		Append('{');
+}
+
+void ExportBuffer::AddField(const char *name, const char *value)
+{
+	BeginField(name);
+	AppendString(value, strlen(value));
+}
+
+void ExportBuffer::AddField(const char *name, const string &value)
+{
+	BeginField(name);
+	AppendString(value.data(), value.size());
+}
+
+template<size_t N>
+void ExportBuffer::AddField(const char *name, const FixedString<N> &value)
+{
+	BeginField(name);
+	AppendString(value.data(), value.size());
+}
+
+void ExportBuffer::AddField(const char *name, long long value)
+{
+	BeginField(name);
+	AppendInteger(value);
+}
+
+void ExportBuffer::AddField(const char *name, double value, int decimals)
+{
+	BeginField(name);
+
+	// fixed point with trailing zeros trimmed, e.g. 2.25 rather than 2.250000
+	static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	decimals = decimals < 0 ? 0 : (decimals > 9 ? 9 : decimals);
+	long long scaled = llround(fabs(value) * powersOfTen[decimals]);
+	long long scale = (long long)powersOfTen[decimals];
+
+	if (value < 0 && scaled != 0)
+		Append('-');
+	AppendInteger(scaled / scale);
+
+	long long fraction = scaled % scale;
+	if (fraction == 0)
+		return;
+
+	char digits[10];
+	int length = decimals;
+	for (int i = decimals - 1; i >= 0; --i, fraction /= 10)
+		digits[i] = (char)('0' + fraction % 10);
+	while (digits[length - 1] == '0')
+		--length;
+
+	Append('.');
+	Append(digits, length);
+}
+
+void ExportBuffer::AddField(const char *name, const date &value)
+{
+	BeginField(name);
+	if (value.is_special())
+	{
+		AppendString("", 0);
+		return;
+	}
+
+	// ISO yyyy-mm-dd
+	date::ymd_type ymd = value.year_month_day();
+	int year = ymd.year;
+	int month = ymd.month;
+	int day = ymd.day;
+	char text[12] = { '"',
+		(char)('0' + year / 1000), (char)('0' + year / 100 % 10), (char)('0' + year / 10 % 10), (char)('0' + year % 10), '-',
+		(char)('0' + month / 10), (char)('0' + month % 10), '-',
+		(char)('0' + day / 10), (char)('0' + day % 10), '"' };
+
+	if (format == JSON_LINES)
+		Append(text, 12);
+	else
+		Append(text + 1, 10);
+}
+
+void ExportBuffer::EndRecord()
+{
+	if (format == JSON_LINES)
+		Append('}');
+	Append('\n');
+	++recordCount;
+}
+
+void ExportBuffer::Flush()
+{
+	// the buffer is emptied even when the write fails, so a retry cannot duplicate records
+	size_t length = size;
+	size = 0;
+	if (length > 0)
+		Write(&buffer[0], length);
+}
+
+size_t ExportBuffer::GetRecordCount() const
+{
+	return recordCount;
+}
+
+bool ExportBuffer::HasFailed() const
+{
+	return failed;
+}
+
+void ExportBuffer::Write(const char *data, size_t length)
+{
+	// flush the stream as well, so errors deferred by its own buffering surface here
+	if (fwrite(data, 1, length, file) != length || fflush(file) != 0)
+	{
+		failed = true;
+		throw "Export write failed";
+	}
+}
+
+void ExportBuffer::Reserve(size_t count)
+{
+	if (size + count > buffer.size())
+		Flush();
+}
+
+void ExportBuffer::Append(const char *data, size_t length)
+{
+	// values longer than the whole buffer are written through
+	if (length > buffer.size())
+	{
+		Flush();
+		Write(data, length);
+		return;
+	}
+
+	Reserve(length);
+	memcpy(&buffer[size], data, length);
+	size += length;
+}
+
+void ExportBuffer::Append(char c)
+{
+	Reserve(1);
+	buffer[size++] = c;
+}
+
+void ExportBuffer::BeginField(const char *name)
+{
+	if (!firstField)
+		Append(',');
+	firstField = false;
+
+	if (format == JSON_LINES)
+	{
+		AppendString(name, strlen(name));
+		Append(':');
+	}
+}
+
+void ExportBuffer::AppendString(const char *value, size_t length)
+{
+	if (format == CSV)
+	{
+		// quote only values which contain a separator, a quote or a line break
+		bool quoted = false;
+		for (size_t i = 0; i < length && !quoted; ++i)
+			quoted = value[i] == ',' || value[i] == '"' || value[i] == '\n' || value[i] == '\r';
+		if (!quoted)
+		{
+			Append(value, length);
+			return;
+		}
+
+		Append('"');
+		for (size_t i = 0; i < length; ++i)
+		{
+			if (value[i] == '"')
+				Append('"');
+			Append(value[i]);
+		}
+		Append('"');
+		return;
+	}
+
+	// JSON strings may not hold control characters, which are written as \u00XX
+	static const char hexDigits[] = "0123456789abcdef";
+	Append('"');
+	for (size_t i = 0; i < length; ++i)
+	{
+		unsigned char c = (unsigned char)value[i];
+		if (c < 0x20)
+		{
+			char escape[6] = { '\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 15] };
+			Append(escape, 6);
+			continue;
+		}
+
+		if (c == '"' || c == '\\')
+			Append('\\');
+		Append(value[i]);
+	}
+	Append('"');
+}
+
+void ExportBuffer::AppendInteger(long long value)
+{
+	char digits[24];
+	int position = 24;
+	unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+	do
+	{
+		digits[--position] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0);
+
+	if (value < 0)
+		digits[--position] = '-';
+
+	Append(digits + position, 24 - position);
+}
+
+#endif
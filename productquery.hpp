@@ -0,0 +1,321 @@
+/**
+* productquery.hpp defines an asynchronous query front-end over the Bond and IRSwap
+* ProductServices, with coalescing of duplicate queries and batched execution on a worker pool
+*/
+
+#ifndef PRODUCTQUERY_HPP
+#define PRODUCTQUERY_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "products.hpp"
+#include "productservice.hpp"
+
+using namespace std;
+
+// Kinds of product queries
+enum QueryKind { BOND_BY_ID, SWAP_BY_ID, BONDS_BY_TICKER, SWAPS_BY_FIXED_DAY_COUNT, SWAPS_BY_PAYMENT_FREQUENCY, SWAPS_BY_FLOATING_INDEX, SWAPS_BY_TERM_ABOVE, SWAPS_BY_TERM_BELOW, SWAPS_BY_SWAP_TYPE, SWAPS_BY_LEG_TYPE };
+
+/**
+* Identity of a query: two queries with equal keys have the same result
+*/
+struct QueryKey
+{
+	QueryKind kind; // kind of query
+	string text; // product id or ticker
+	int value; // enum value or term of a swap filter
+
+	QueryKey(QueryKind _kind, const string &_text, int _value) : kind(_kind), text(_text), value(_value) {}
+
+	bool operator<(const QueryKey &other) const
+	{
+		if (kind != other.kind)
+			return kind < other.kind;
+		if (value != other.value)
+			return value < other.value;
+		return text < other.text;
+	}
+};
+
+/**
+* Asynchronous query service over the bond and swap services.
+* Queries are queued and answered through shared futures. A query equal to one still
+* queued is not queued again but shares its future, so a burst of identical queries is
+* computed once. A query stops being shared when a worker takes it, before the snapshots
+* answering it are pinned, so a shared result is never older than the query sharing it. Workers take the queued queries in batches of up to maxBatchSize, sort
+* each batch by query key, so that lookups of neighbouring ids walk the same tree paths,
+* and answer the whole batch from one pinned snapshot of each service.
+* Product lookups of an unknown id fail their future with the exception of the service.
+*/
+class ProductQueryService
+{
+public:
+	// ProductQueryService ctor: starts workerCount workers, one per core by default
+	ProductQueryService(BondProductService &_bondProductService, IRSwapProductService &_swapProductService, size_t workerCount = 0, size_t _maxBatchSize = 256);
+
+	// Answer the queries already submitted, then stop the workers
+	~ProductQueryService();
+
+	// Submit a product lookup by id
+	shared_future<shared_ptr<const Bond> > GetData(const string &productId);
+	shared_future<shared_ptr<const IRSwap> > GetSwapData(const string &productId);
+
+	// Submit a query for the bonds of a ticker
+	shared_future<vector<Bond> > GetBonds(const string &_ticker);
+
+	// Submit a query for the swaps matching a filter
+	shared_future<vector<IRSwap> > GetSwaps(DayCountConvention _fixedLegDayCountConvention);
+	shared_future<vector<IRSwap> > GetSwaps(PaymentFrequency _fixedLegPaymentFrequency);
+	shared_future<vector<IRSwap> > GetSwaps(FloatingIndex _floatingIndex);
+	shared_future<vector<IRSwap> > GetSwapsGreaterThan(int _termYears);
+	shared_future<vector<IRSwap> > GetSwapsLessThan(int _termYears);
+	shared_future<vector<IRSwap> > GetSwaps(SwapType _swapType);
+	shared_future<vector<IRSwap> > GetSwaps(SwapLegType _swapLegType);
+
+	// Return the number of queries submitted, and how many of them shared a queued query
+	size_t GetSubmittedCount() const;
+	size_t GetCoalescedCount() const;
+
+	// Return the number of batches run by the workers
+	size_t GetBatchCount() const;
+
+private:
+	// Queued query: its key, the removal of its in-flight entry and the work answering it from pinned snapshots
+	struct Query
+	{
+		QueryKey key;
+		std::function<void()> leave;
+		std::function<void(const BondSnapshot&, const IRSwapSnapshot&)> run;
+
+		bool operator<(const Query &other) const { return key < other.key; }
+	};
+
+	BondProductService &bondProductService;
+	IRSwapProductService &swapProductService;
+	size_t maxBatchSize; // most queries answered from one pair of snapshots
+
+	mutable mutex queueMutex; // guards everything below
+	condition_variable queueReady; // signalled on new queries and on shutdown
+	deque<Query> queue; // queries waiting for a worker
+	bool stopping; // true once the workers should exit
+	size_t submittedCount; // queries submitted
+	size_t coalescedCount; // queries which shared a queued query
+	size_t batchCount; // batches run
+
+	// queued queries open to sharing, by result type
+	map<QueryKey, shared_future<shared_ptr<const Bond> > > bondsInFlight;
+	map<QueryKey, shared_future<shared_ptr<const IRSwap> > > swapsInFlight;
+	map<QueryKey, shared_future<vector<Bond> > > bondListsInFlight;
+	map<QueryKey, shared_future<vector<IRSwap> > > swapListsInFlight;
+
+	vector<thread> workers;
+
+	// Return the future of an equal queued query, or queue the query
+	template<typename T>
+	shared_future<T> Submit(map<QueryKey, shared_future<T> > &inFlight, const QueryKey &key, std::function<T(const BondSnapshot&, const IRSwapSnapshot&)> compute);
+
+	// Submit a swap filter
+	shared_future<vector<IRSwap> > SubmitSwapFilter(QueryKind kind, int value, std::function<vector<IRSwap>(const IRSwapSnapshot&)> filter);
+
+	// Worker loop: run batches until stopped and the queue is empty
+	void Work();
+};
+
+ProductQueryService::ProductQueryService(BondProductService &_bondProductService, IRSwapProductService &_swapProductService, size_t workerCount, size_t _maxBatchSize)
+	: bondProductService(_bondProductService), swapProductService(_swapProductService), maxBatchSize(_maxBatchSize == 0 ? 1 : _maxBatchSize),
+	stopping(false), submittedCount(0), coalescedCount(0), batchCount(0)
+{
+	if (workerCount == 0)
+		workerCount = thread::hardware_concurrency();
+	if (workerCount == 0)
+		workerCount = 1;
+
+	for (size_t i = 0; i < workerCount; ++i)
+		workers.push_back(thread(&ProductQueryService::Work, this));
+}
+
+ProductQueryService::~ProductQueryService()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueReady.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+shared_future<shared_ptr<const Bond> > ProductQueryService::GetData(const string &productId)
+{
+	return Submit<shared_ptr<const Bond> >(bondsInFlight, QueryKey(BOND_BY_ID, productId, 0),
+		[productId](const BondSnapshot &bonds, const IRSwapSnapshot&) -> shared_ptr<const Bond>
+	{
+		shared_ptr<const Bond> bond = bonds.FindShared(productId);
+		if (!bond)
+			throw "Bond not found";
+		return bond;
+	});
+}
+
+shared_future<shared_ptr<const IRSwap> > ProductQueryService::GetSwapData(const string &productId)
+{
+	return Submit<shared_ptr<const IRSwap> >(swapsInFlight, QueryKey(SWAP_BY_ID, productId, 0),
+		[productId](const BondSnapshot&, const IRSwapSnapshot &swaps) -> shared_ptr<const IRSwap>
+	{
+		shared_ptr<const IRSwap> swap = swaps.FindShared(productId);
+		if (!swap)
+			throw "IR Swap not found";
+		return swap;
+	});
+}
+
+shared_future<vector<Bond> > ProductQueryService::GetBonds(const string &_ticker)
+{
+	return Submit<vector<Bond> >(bondListsInFlight, QueryKey(BONDS_BY_TICKER, _ticker, 0),
+		[_ticker](const BondSnapshot &bonds, const IRSwapSnapshot&) { return bonds.GetBonds(_ticker); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwaps(DayCountConvention _fixedLegDayCountConvention)
+{
+	return SubmitSwapFilter(SWAPS_BY_FIXED_DAY_COUNT, _fixedLegDayCountConvention,
+		[_fixedLegDayCountConvention](const IRSwapSnapshot &swaps) { return swaps.GetSwaps(_fixedLegDayCountConvention); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwaps(PaymentFrequency _fixedLegPaymentFrequency)
+{
+	return SubmitSwapFilter(SWAPS_BY_PAYMENT_FREQUENCY, _fixedLegPaymentFrequency,
+		[_fixedLegPaymentFrequency](const IRSwapSnapshot &swaps) { return swaps.GetSwaps(_fixedLegPaymentFrequency); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwaps(FloatingIndex _floatingIndex)
+{
+	return SubmitSwapFilter(SWAPS_BY_FLOATING_INDEX, _floatingIndex,
+		[_floatingIndex](const IRSwapSnapshot &swaps) { return swaps.GetSwaps(_floatingIndex); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwapsGreaterThan(int _termYears)
+{
+	return SubmitSwapFilter(SWAPS_BY_TERM_ABOVE, _termYears,
+		[_termYears](const IRSwapSnapshot &swaps) { return swaps.GetSwapsGreaterThan(_termYears); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwapsLessThan(int _termYears)
+{
+	return SubmitSwapFilter(SWAPS_BY_TERM_BELOW, _termYears,
+		[_termYears](const IRSwapSnapshot &swaps) { return swaps.GetSwapsLessThan(_termYears); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwaps(SwapType _swapType)
+{
+	return SubmitSwapFilter(SWAPS_BY_SWAP_TYPE, _swapType,
+		[_swapType](const IRSwapSnapshot &swaps) { return swaps.GetSwaps(_swapType); });
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::GetSwaps(SwapLegType _swapLegType)
+{
+	return SubmitSwapFilter(SWAPS_BY_LEG_TYPE, _swapLegType,
+		[_swapLegType](const IRSwapSnapshot &swaps) { return swaps.GetSwaps(_swapLegType); });
+}
+
+size_t ProductQueryService::GetSubmittedCount() const
+{
+	lock_guard<mutex> lock(queueMutex);
+	return submittedCount;
+}
+
+size_t ProductQueryService::GetCoalescedCount() const
+{
+	lock_guard<mutex> lock(queueMutex);
+	return coalescedCount;
+}
+
+size_t ProductQueryService::GetBatchCount() const
+{
+	lock_guard<mutex> lock(queueMutex);
+	return batchCount;
+}
+
+template<typename T>
+shared_future<T> ProductQueryService::Submit(map<QueryKey, shared_future<T> > &inFlight, const QueryKey &key, std::function<T(const BondSnapshot&, const IRSwapSnapshot&)> compute)
+{
+	lock_guard<mutex> lock(queueMutex);
+	++submittedCount;
+
+	typename map<QueryKey, shared_future<T> >::iterator it = inFlight.find(key);
+	if (it != inFlight.end())
+	{
+		++coalescedCount;
+		return it->second;
+	}
+
+	shared_ptr<promise<T> > result = make_shared<promise<T> >();
+	shared_future<T> future = result->get_future().share();
+	inFlight.insert(make_pair(key, future));
+
+	map<QueryKey, shared_future<T> > *inFlightMap = &inFlight;
+	Query query = { key, [inFlightMap, key]() { inFlightMap->erase(key); },
+		[result, compute](const BondSnapshot &bonds, const IRSwapSnapshot &swaps)
+	{
+		try
+		{
+			result->set_value(compute(bonds, swaps));
+		}
+		catch (...)
+		{
+			result->set_exception(current_exception());
+		}
+	} };
+	queue.push_back(query);
+	queueReady.notify_one();
+	return future;
+}
+
+shared_future<vector<IRSwap> > ProductQueryService::SubmitSwapFilter(QueryKind kind, int value, std::function<vector<IRSwap>(const IRSwapSnapshot&)> filter)
+{
+	return Submit<vector<IRSwap> >(swapListsInFlight, QueryKey(kind, string(), value),
+		[filter](const BondSnapshot&, const IRSwapSnapshot &swaps) { return filter(swaps); });
+}
+
+void ProductQueryService::Work()
+{
+	vector<Query> batch;
+	for (;;)
+	{
+		batch.clear();
+		{
+			unique_lock<mutex> lock(queueMutex);
+			while (!stopping && queue.empty())
+				queueReady.wait(lock);
+			if (queue.empty())
+				return;
+
+			size_t count = min(queue.size(), maxBatchSize);
+			batch.assign(queue.begin(), queue.begin() + count);
+			queue.erase(queue.begin(), queue.begin() + count);
+			++batchCount;
+
+			// queries submitted from now on are computed afresh, from snapshots pinned after them
+			for (size_t i = 0; i < batch.size(); ++i)
+				batch[i].leave();
+		}
+
+		// equal kinds and neighbouring ids next to each other, all answered from the same versions
+		sort(batch.begin(), batch.end());
+		BondSnapshot bonds = bondProductService.GetSnapshot();
+		IRSwapSnapshot swaps = swapProductService.GetSnapshot();
+		for (size_t i = 0; i < batch.size(); ++i)
+			batch[i].run(bonds, swaps);
+	}
+}
+
+#endif
@@ -0,0 +1,404 @@
+/**
+* productregistry.hpp defines a ProductRegistry fronting the Bond, IRSwap and Future
+* ProductServices with a single product id space
+*/
+
+#ifndef PRODUCTREGISTRY_HPP
+#define PRODUCTREGISTRY_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "products.hpp"
+#include "productservice.hpp"
+
+// Handle of a product in a ProductRegistry: its dense slot in the low 32 bits and the
+// generation of the slot in the high 32 bits
+typedef unsigned long long ProductHandle;
+
+/**
+* Registry of the products of all product services.
+* Every product gets a dense handle; one hash probe resolves a product id to its handle,
+* and the handle gives the product type and the product held by its service without
+* any further string lookup. Product ids are expected to be unique across the services.
+* Each slot shares ownership of its product with the service and watches the flag the
+* service raises when it replaces or removes that product. Only then is the slot checked
+* again with one lookup of its own id, so products replaced or removed directly in their
+* service are followed, and changes to other products cost the slot nothing.
+* References returned by the registry are valid until the product is replaced or removed.
+* Slots of removed products are reused by the next products added, so the handle
+* table stays as large as the set of live products. Each reuse bumps the generation of the
+* slot, so a handle kept from before the removal is rejected instead of resolving to the
+* product added after it.
+*/
+class ProductRegistry
+{
+public:
+	// ProductRegistry ctor
+	ProductRegistry(BondProductService &_bondProductService, IRSwapProductService &_swapProductService, FutureProductService &_futureProductService);
+
+	// Add a product to its service and return its handle.
+	// A product added under the id of a product of another type replaces it in the registry and
+	// removes it from its service; handles then no longer resolve to the other type.
+	ProductHandle Add(const Bond &bond);
+	ProductHandle Add(const IRSwap &swap);
+	ProductHandle Add(const Future &future);
+
+	// Return the handle of a product id. Products added to a service directly are looked up
+	// in each service once, on their first resolution.
+	ProductHandle Resolve(const string &productId);
+
+	// Return the handle of a product id in handle, or false when no service holds the product
+	bool TryResolve(const string &productId, ProductHandle &handle);
+
+	// Remove a product from its service and release its handle, returning false when there is none
+	bool Remove(const string &productId);
+
+	// Group the following updates of the versioned services into a single version each
+	void BeginBatch();
+	void EndBatch();
+
+	// Return the product type of a handle
+	ProductType GetProductType(ProductHandle handle);
+
+	// Return the product of a handle
+	const Product& GetProduct(ProductHandle handle);
+
+	// Return the typed product of a handle, throwing when the handle has another product type
+	const Bond& GetBond(ProductHandle handle);
+	const IRSwap& GetSwap(ProductHandle handle);
+	const Future& GetFuture(ProductHandle handle);
+
+	// Return the number of registered products
+	size_t GetSize() const;
+
+	// Return the memory taken by the handle index; the products are counted by their services
+	MemoryUsage GetMemoryUsage() const;
+
+	// Forget all handles, e.g. after the services have been cleared for a reload; handles
+	// given out before stay invalid
+	void Clear();
+
+private:
+	// Slot of a product: its type and its storage in the owning service
+	struct Entry
+	{
+		ProductType productType; // type of the product
+		unsigned int generation; // number of times the slot was released
+		shared_ptr<const Product> product; // product shared with its service, empty when released
+		const bool *replaced; // flag raised by the service when it replaces or removes the product
+	};
+
+	BondProductService &bondProductService;
+	IRSwapProductService &swapProductService;
+	FutureProductService &futureProductService;
+
+	unordered_map<ProductId, ProductHandle> handles; // product id, held inline -> handle
+	vector<Entry> entries; // handle -> slot, with a null product when released
+	vector<size_t> freeSlots; // released slots, reused first
+
+	// Return the handle of a product bound to a slot, registering it when new
+	ProductHandle Register(const Entry &bound);
+
+	// Remove a product from the service of its product type
+	void RemoveFromService(const string &productId, ProductType productType);
+
+	// Bind a slot to a product held by a service, returning false when there is none
+	template<typename V>
+	static bool Bind(Entry &entry, ProductType productType, const shared_ptr<const StoredProduct<V> > &stored);
+	bool Bind(Entry &entry, const string &productId, ProductType productType);
+
+	// Check a slot against its service once its product was replaced or removed, releasing the slot when the product is gone
+	bool Refresh(size_t slot);
+
+	// Release a slot for reuse
+	void Release(size_t slot);
+
+	// Return the slot of a handle
+	static size_t GetSlot(ProductHandle handle);
+
+	// Return the handle of a slot in its current generation
+	ProductHandle GetHandle(size_t slot) const;
+
+	// Return the slot of a live handle, optionally with the expected product type
+	const Entry& GetEntry(ProductHandle handle);
+	const Entry& GetEntry(ProductHandle handle, ProductType productType);
+};
+
+ProductRegistry::ProductRegistry(BondProductService &_bondProductService, IRSwapProductService &_swapProductService, FutureProductService &_futureProductService)
+	: bondProductService(_bondProductService), swapProductService(_swapProductService), futureProductService(_futureProductService)
+{
+}
+
+ProductHandle ProductRegistry::Add(const Bond &bond)
+{
+	bondProductService.Add(bond);
+
+	Entry entry;
+	Bind(entry, BOND, bondProductService.FindStored(bond.GetProductId()));
+	return Register(entry);
+}
+
+ProductHandle ProductRegistry::Add(const IRSwap &swap)
+{
+	swapProductService.Add(swap);
+
+	Entry entry;
+	Bind(entry, IRSWAP, swapProductService.FindStored(swap.GetProductId()));
+	return Register(entry);
+}
+
+ProductHandle ProductRegistry::Add(const Future &future)
+{
+	futureProductService.Add(future);
+
+	Entry entry;
+	Bind(entry, FUTURE, futureProductService.FindStored(future.GetProductId()));
+	return Register(entry);
+}
+
+ProductHandle ProductRegistry::Resolve(const string &productId)
+{
+	ProductHandle handle;
+	if (!TryResolve(productId, handle))
+		throw "Product not found";
+
+	return handle;
+}
+
+bool ProductRegistry::TryResolve(const string &productId, ProductHandle &handle)
+{
+	// no product has an id longer than a ProductId holds
+	if (!ProductId::Fits(productId))
+		return false;
+
+	unordered_map<ProductId, ProductHandle>::const_iterator it = handles.find(ProductId(productId));
+	if (it != handles.end() && Refresh(GetSlot(it->second)))
+	{
+		handle = it->second;
+		return true;
+	}
+
+	// unknown, or released by Refresh(): look in every service
+
+	Entry entry;
+	if (!Bind(entry, productId, BOND) && !Bind(entry, productId, IRSWAP) && !Bind(entry, productId, FUTURE))
+		return false;
+
+	handle = Register(entry);
+	return true;
+}
+
+bool ProductRegistry::Remove(const string &productId)
+{
+	ProductHandle handle;
+	if (!TryResolve(productId, handle))
+		return false;
+
+	RemoveFromService(productId, entries[GetSlot(handle)].productType);
+	Release(GetSlot(handle));
+	return true;
+}
+
+void ProductRegistry::BeginBatch()
+{
+	bondProductService.BeginBatch();
+	swapProductService.BeginBatch();
+}
+
+void ProductRegistry::EndBatch()
+{
+	bondProductService.EndBatch();
+	swapProductService.EndBatch();
+}
+
+ProductType ProductRegistry::GetProductType(ProductHandle handle)
+{
+	return GetEntry(handle).productType;
+}
+
+const Product& ProductRegistry::GetProduct(ProductHandle handle)
+{
+	return *GetEntry(handle).product;
+}
+
+const Bond& ProductRegistry::GetBond(ProductHandle handle)
+{
+	return static_cast<const Bond&>(*GetEntry(handle, BOND).product);
+}
+
+const IRSwap& ProductRegistry::GetSwap(ProductHandle handle)
+{
+	return static_cast<const IRSwap&>(*GetEntry(handle, IRSWAP).product);
+}
+
+const Future& ProductRegistry::GetFuture(ProductHandle handle)
+{
+	return static_cast<const Future&>(*GetEntry(handle, FUTURE).product);
+}
+
+size_t ProductRegistry::GetSize() const
+{
+	return entries.size() - freeSlots.size();
+}
+
+MemoryUsage ProductRegistry::GetMemoryUsage() const
+{
+	MemoryUsage usage;
+	usage.count = GetSize();
+
+	// hash buckets, then one node per id with its next link and cached hash
+	usage.indexBytes = handles.bucket_count() * sizeof(void*);
+	usage.indexBytes += handles.size() * (sizeof(unordered_map<ProductId, ProductHandle>::value_type) + 2 * sizeof(void*));
+
+	usage.indexBytes += entries.capacity() * sizeof(Entry) + freeSlots.capacity() * sizeof(size_t);
+	return usage;
+}
+
+void ProductRegistry::Clear()
+{
+	// the slots are kept with their generations so that no earlier handle resolves again
+	handles.clear();
+	freeSlots.clear();
+	for (size_t slot = entries.size(); slot-- > 0;)
+	{
+		if (entries[slot].product)
+		{
+			entries[slot].product.reset();
+			entries[slot].replaced = 0;
+			++entries[slot].generation;
+		}
+		freeSlots.push_back(slot);
+	}
+}
+
+ProductHandle ProductRegistry::Register(const Entry &bound)
+{
+	const ProductId &productId = bound.product->GetProductId();
+	size_t slot = freeSlots.empty() ? entries.size() : freeSlots.back();
+	ProductHandle handle = freeSlots.empty() ? (ProductHandle)slot : GetHandle(slot);
+	pair<unordered_map<ProductId, ProductHandle>::iterator, bool> result = handles.insert(make_pair(productId, handle));
+	if (!result.second)
+	{
+		// a product added again replaces the previous one in its service, or in another service
+		// when its type changed, leaving a single product with the id
+		Entry &existing = entries[GetSlot(result.first->second)];
+		if (existing.productType != bound.productType)
+			RemoveFromService(productId, existing.productType);
+
+		existing.productType = bound.productType;
+		existing.product = bound.product;
+		existing.replaced = bound.replaced;
+		return result.first->second;
+	}
+
+	Entry entry = bound;
+	entry.generation = (unsigned int)(handle >> 32);
+	if (freeSlots.empty())
+	{
+		entries.push_back(entry);
+	}
+	else
+	{
+		freeSlots.pop_back();
+		entries[slot] = entry;
+	}
+	return handle;
+}
+
+void ProductRegistry::RemoveFromService(const string &productId, ProductType productType)
+{
+	switch (productType)
+	{
+	case BOND:
+		bondProductService.Remove(productId);
+		break;
+	case IRSWAP:
+		swapProductService.Remove(productId);
+		break;
+	default:
+		futureProductService.Remove(productId);
+		break;
+	}
+}
+
+template<typename V>
+bool ProductRegistry::Bind(Entry &entry, ProductType productType, const shared_ptr<const StoredProduct<V> > &stored)
+{
+	if (!stored)
+		return false;
+
+	// the slot shares the stored product, so its flag lives as long as the slot holds it
+	entry.productType = productType;
+	entry.product = shared_ptr<const Product>(stored, &stored->product);
+	entry.replaced = &stored->replaced;
+	return true;
+}
+
+bool ProductRegistry::Bind(Entry &entry, const string &productId, ProductType productType)
+{
+	switch (productType)
+	{
+	case BOND:
+		return Bind(entry, productType, bondProductService.FindStored(productId));
+	case IRSWAP:
+		return Bind(entry, productType, swapProductService.FindStored(productId));
+	default:
+		return Bind(entry, productType, futureProductService.FindStored(productId));
+	}
+}
+
+bool ProductRegistry::Refresh(size_t slot)
+{
+	Entry &entry = entries[slot];
+	if (!*entry.replaced)
+		return true;
+
+	// the product was replaced or removed in its service: follow its id once
+	if (!Bind(entry, entry.product->GetProductId(), entry.productType))
+	{
+		Release(slot);
+		return false;
+	}
+	return true;
+}
+
+void ProductRegistry::Release(size_t slot)
+{
+	Entry &entry = entries[slot];
+	handles.erase(handles.find(entry.product->GetProductId()));
+	entry.product.reset();
+	entry.replaced = 0;
+	++entry.generation;
+	freeSlots.push_back(slot);
+}
+
+size_t ProductRegistry::GetSlot(ProductHandle handle)
+{
+	return (size_t)(handle & 0xFFFFFFFFULL);
+}
+
+ProductHandle ProductRegistry::GetHandle(size_t slot) const
+{
+	return ((ProductHandle)entries[slot].generation << 32) | slot;
+}
+
+const ProductRegistry::Entry& ProductRegistry::GetEntry(ProductHandle handle)
+{
+	size_t slot = GetSlot(handle);
+	if (slot >= entries.size() || !entries[slot].product || GetHandle(slot) != handle || !Refresh(slot))
+		throw "Invalid product handle";
+
+	return entries[slot];
+}
+
+const ProductRegistry::Entry& ProductRegistry::GetEntry(ProductHandle handle, ProductType productType)
+{
+	const Entry &entry = GetEntry(handle);
+	if (entry.productType != productType)
+		throw "Invalid product handle";
+
+	return entry;
+}
+
+#endif
@@ -8,14 +8,32 @@
 
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "boost/date_time/gregorian/gregorian.hpp"
+#include "fixedstring.hpp"
+#include "memoryusage.hpp"
+#include "price.hpp"
 
 using namespace std;
 using namespace boost::gregorian;
 
+// Product enums are one byte each and ids and tickers are held inline, so that products
+// pack their fields without padding and own no heap memory
+
 // Product Types
-enum ProductType { IRSWAP, BOND, FUTURE, INTEREST_RATE };
+enum ProductType : unsigned char { IRSWAP, BOND, FUTURE, INTEREST_RATE };
+
+// Return the name of an enum value from its table of names, "" when out of range
+template<typename E, size_t N>
+constexpr const char* ToName(const char* const (&names)[N], E value)
+{
+	return (size_t)value < N ? names[value] : "";
+}
+
+// Product Type names
+constexpr const char* PRODUCT_TYPE_NAMES[] = { "IRSwap", "Bond", "Future", "InterestRate" };
 
 /**
 * Definition of a base Product class
@@ -24,23 +42,29 @@ class Product
 {
 
 public:
-	// Product ctor
-	Product(string _productId, ProductType _productType);
+	// Product ctor, throwing when the id is longer than ProductId::CAPACITY
+	Product(const string &_productId, ProductType _productType);
 	Product() {};
 
 	// Retrurn the product identifier
-	string GetProductId() const;
+	const ProductId& GetProductId() const;
 
 	// Return the Product Type for this Product
 	ProductType GetProductType() const;
 
+	// Return the heap bytes held by the product outside its object, none unless a derived product holds a container
+	size_t GetHeapBytes() const;
+
 private:
-	string productId; // product id variab;e
+	ProductId productId; // product id variable, held inline
 	ProductType productType; // product type variable
 };
 
 // Types of bond identifiers: ISIN (used primarily in Europe) and CUSIP (for US)
-enum BondIdType { CUSIP, ISIN };
+enum BondIdType : unsigned char { CUSIP, ISIN };
+
+// Bond identifier type names
+constexpr const char* BOND_ID_TYPE_NAMES[] = { "CUSIP", "ISIN" };
 
 /**
 * Modeling of a Bond Product
@@ -49,11 +73,11 @@ class Bond : public Product
 {
 public:
 	// Bond ctor
-	Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate);
+	Bond(const string &_productId, BondIdType _bondIdType, const string &_ticker, float _coupon, date _maturityDate);
 	Bond();
 
 	// Return the ticker of the bond
-	string GetTicker() const;
+	const Ticker& GetTicker() const;
 
 	// Return the coupon of the bond
 	float GetCoupon() const;
@@ -68,33 +92,42 @@ public:
 	friend ostream& operator<<(ostream &output, const Bond &bond);
 
 private:
-	string productId; // product identifier variable
+	// small fields first, right after the inline id of Product
 	BondIdType bondIdType; // bond id type variable
-	string ticker; // ticker variable
 	float coupon; // coupon variable
-	date maturityDate; // maturity date variable
+	date maturityDate; // maturity date variable, a 32-bit day number
+	Ticker ticker; // ticker variable, held inline
 };
 
 // Day Count convention values
-enum DayCountConvention { THIRTY_THREE_SIXTY, ACT_THREE_SIXTY, ACT_THREE_SIXTY_FIVE };
+enum DayCountConvention : unsigned char { THIRTY_THREE_SIXTY, ACT_THREE_SIXTY, ACT_THREE_SIXTY_FIVE };
 
 // Payment Frequency values
-enum PaymentFrequency { QUARTERLY, SEMI_ANNUAL, ANNUAL };
+enum PaymentFrequency : unsigned char { QUARTERLY, SEMI_ANNUAL, ANNUAL };
 
 // Index on the floating leg of an IR Swap
-enum FloatingIndex { LIBOR, EURIBOR };
+enum FloatingIndex : unsigned char { LIBOR, EURIBOR };
 
 // Tenor on the floating leg of an IR Swap
-enum FloatingIndexTenor { TENOR_1M, TENOR_3M, TENOR_6M, TENOR_12M };
+enum FloatingIndexTenor : unsigned char { TENOR_1M, TENOR_3M, TENOR_6M, TENOR_12M };
 
 // Currency for the IR Swap
-enum Currency { USD, EUR, GBP };
+enum Currency : unsigned char { USD, EUR, GBP };
 
 // IR Swap type
-enum SwapType { SPOT, FORWARD, IMM, MAC, BASIS };
+enum SwapType : unsigned char { SPOT, FORWARD, IMM, MAC, BASIS };
 
 // IR Swap leg type (i.e. outright is one leg, curve is two legs, fly is three legs
-enum SwapLegType { OUTRIGHT, CURVE, FLY };
+enum SwapLegType : unsigned char { OUTRIGHT, CURVE, FLY };
+
+// IR Swap enum names
+constexpr const char* DAY_COUNT_CONVENTION_NAMES[] = { "30/360", "Act/360", "Act/365" };
+constexpr const char* PAYMENT_FREQUENCY_NAMES[] = { "Quarterly", "Semi-Annual", "Annual" };
+constexpr const char* FLOATING_INDEX_NAMES[] = { "LIBOR", "EURIBOR" };
+constexpr const char* FLOATING_INDEX_TENOR_NAMES[] = { "1m", "3m", "6m", "12m" };
+constexpr const char* CURRENCY_NAMES[] = { "USD", "EUR", "GBP" };
+constexpr const char* SWAP_TYPE_NAMES[] = { "Standard", "Forward", "IMM", "MAC", "Basis" };
+constexpr const char* SWAP_LEG_TYPE_NAMES[] = { "Outright", "Curve", "Fly" };
 
 /**
 * Modeling of an Interest Rate Swap Product
@@ -103,7 +136,7 @@ class IRSwap : public Product
 {
 public:
 	// IRSwap ctor
-	IRSwap(string productId, DayCountConvention _fixedLegDayCountConvention, DayCountConvention _floatingLegDayCountConvention, PaymentFrequency _fixedLegPaymentFrequency, FloatingIndex _floatingIndex, FloatingIndexTenor _floatingIndexTenor, date _effectiveDate, date _terminationDate, Currency _currency, int termYears, SwapType _swapType, SwapLegType _swapLegType);
+	IRSwap(const string &productId, DayCountConvention _fixedLegDayCountConvention, DayCountConvention _floatingLegDayCountConvention, PaymentFrequency _fixedLegPaymentFrequency, FloatingIndex _floatingIndex, FloatingIndexTenor _floatingIndexTenor, date _effectiveDate, date _terminationDate, Currency _currency, int termYears, SwapType _swapType, SwapLegType _swapLegType);
 	IRSwap();
 
 	// Return the day count convention on the fixed leg of the IR Swap
@@ -143,47 +176,51 @@ public:
 	friend ostream& operator<<(ostream &output, const IRSwap &swap);
 
 private:
+	// the one-byte enums first, right after the inline id of Product
 	DayCountConvention fixedLegDayCountConvention; // fixed leg daycount convention variable
 	DayCountConvention floatingLegDayCountConvention; // floating leg daycount convention variable
 	PaymentFrequency fixedLegPaymentFrequency; // fixed leg payment freq
 	FloatingIndex floatingIndex; // floating leg index
 	FloatingIndexTenor floatingIndexTenor; // floating leg tenor
-	date effectiveDate; // effective date
-	date terminationDate; // termination date
 	Currency currency; // currency
-	int termYears; // term in years
 	SwapType swapType; // swap type
 	SwapLegType swapLegType; // swap leg type
+	date effectiveDate; // effective date
+	date terminationDate; // termination date
+	int termYears; // term in years
 
 							 // return a string represenation for the day count convention
-	string ToString(DayCountConvention dayCountConvention) const;
+	const char* ToString(DayCountConvention dayCountConvention) const;
 
 	// return a string represenation for the payment frequency
-	string ToString(PaymentFrequency paymentFrequency) const;
+	const char* ToString(PaymentFrequency paymentFrequency) const;
 
 	// return a string representation for the floating index
-	string ToString(FloatingIndex floatingIndex) const;
+	const char* ToString(FloatingIndex floatingIndex) const;
 
 	// return a string representation of the flaoting index tenor
-	string ToString(FloatingIndexTenor floatingIndexTenor) const;
+	const char* ToString(FloatingIndexTenor floatingIndexTenor) const;
 
 	// return a string representation of the currency
-	string ToString(Currency currency) const;
+	const char* ToString(Currency currency) const;
 
 	// return a string representation of the swap type
-	string ToString(SwapType swapType) const;
+	const char* ToString(SwapType swapType) const;
 
 	// return a string representation of the swap leg type
-	string ToString(SwapLegType swapLegType) const;
+	const char* ToString(SwapLegType swapLegType) const;
 };
 
-Product::Product(string _productId, ProductType _productType)
+Product::Product(const string &_productId, ProductType _productType)
 {
+	if (!ProductId::Fits(_productId))
+		throw "Product id too long";
+
 	productId = _productId;
 	productType = _productType;
 }
 
-string Product::GetProductId() const
+const ProductId& Product::GetProductId() const
 {
 	return productId;
 }
@@ -193,19 +230,27 @@ ProductType Product::GetProductType() const
 	return productType;
 }
 
-Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate) : Product(_productId, BOND)
+size_t Product::GetHeapBytes() const
+{
+	return 0;
+}
+
+Bond::Bond(const string &_productId, BondIdType _bondIdType, const string &_ticker, float _coupon, date _maturityDate) : Product(_productId, BOND)
 {
+	if (!Ticker::Fits(_ticker))
+		throw "Ticker too long";
+
 	bondIdType = _bondIdType;
 	ticker = _ticker;
 	coupon = _coupon;
 	maturityDate = _maturityDate;
 }
 
-Bond::Bond() : Product(0, BOND)
+Bond::Bond() : Product(string(), BOND)
 {
 }
 
-string Bond::GetTicker() const
+const Ticker& Bond::GetTicker() const
 {
 	return ticker;
 }
@@ -231,7 +276,7 @@ ostream& operator<<(ostream &output, const Bond &bond)
 	return output;
 }
 
-IRSwap::IRSwap(string _productId, DayCountConvention _fixedLegDayCountConvention, DayCountConvention _floatingLegDayCountConvention, PaymentFrequency _fixedLegPaymentFrequency, FloatingIndex _floatingIndex, FloatingIndexTenor _floatingIndexTenor, date _effectiveDate, date _terminationDate, Currency _currency, int _termYears, SwapType _swapType, SwapLegType _swapLegType) : Product(_productId, IRSWAP)
+IRSwap::IRSwap(const string &_productId, DayCountConvention _fixedLegDayCountConvention, DayCountConvention _floatingLegDayCountConvention, PaymentFrequency _fixedLegPaymentFrequency, FloatingIndex _floatingIndex, FloatingIndexTenor _floatingIndexTenor, date _effectiveDate, date _terminationDate, Currency _currency, int _termYears, SwapType _swapType, SwapLegType _swapLegType) : Product(_productId, IRSWAP)
 {
 	fixedLegDayCountConvention = _fixedLegDayCountConvention;
 	floatingLegDayCountConvention = _floatingLegDayCountConvention;
@@ -246,7 +291,7 @@ IRSwap::IRSwap(string _productId, DayCountConvention _fixedLegDayCountConvention
 	swapLegType = _swapLegType;
 }
 
-IRSwap::IRSwap() : Product(0, IRSWAP)
+IRSwap::IRSwap() : Product(string(), IRSWAP)
 {
 }
 
@@ -312,116 +357,99 @@ ostream& operator<<(ostream &output, const IRSwap &swap)
 	return output;
 }
 
-string IRSwap::ToString(DayCountConvention dayCountConvention) const
+const char* IRSwap::ToString(DayCountConvention dayCountConvention) const
 {
-	switch (dayCountConvention) {
-	case THIRTY_THREE_SIXTY: return "30/360";
-	case ACT_THREE_SIXTY: return "Act/360";
-	default: return "";
-	}
+	return ToName(DAY_COUNT_CONVENTION_NAMES, dayCountConvention);
 }
 
-string IRSwap::ToString(PaymentFrequency paymentFrequency) const
+const char* IRSwap::ToString(PaymentFrequency paymentFrequency) const
 {
-	switch (paymentFrequency) {
-	case QUARTERLY: return "Quarterly";
-	case SEMI_ANNUAL: return "Semi-Annual";
-	case ANNUAL: return "Annual";
-	default: return "";
-	}
+	return ToName(PAYMENT_FREQUENCY_NAMES, paymentFrequency);
 }
 
-string IRSwap::ToString(FloatingIndex floatingIndex) const
+const char* IRSwap::ToString(FloatingIndex floatingIndex) const
 {
-	switch (floatingIndex) {
-	case LIBOR: return "LIBOR";
-	case EURIBOR: return "EURIBOR";
-	default: return "";
-	}
+	return ToName(FLOATING_INDEX_NAMES, floatingIndex);
 }
 
-string IRSwap::ToString(FloatingIndexTenor floatingIndexTenor) const
+const char* IRSwap::ToString(FloatingIndexTenor floatingIndexTenor) const
 {
-	switch (floatingIndexTenor) {
-	case TENOR_1M: return "1m";
-	case TENOR_3M: return "3m";
-	case TENOR_6M: return "6m";
-	case TENOR_12M: return "12m";
-	default: return "";
-	}
+	return ToName(FLOATING_INDEX_TENOR_NAMES, floatingIndexTenor);
 }
 
-string IRSwap::ToString(Currency currency) const
+const char* IRSwap::ToString(Currency currency) const
 {
-	switch (currency) {
-	case USD: return "USD";
-	case EUR: return "EUR";
-	case GBP: return "GBP";
-	default: return "";
-	}
+	return ToName(CURRENCY_NAMES, currency);
 }
 
-string IRSwap::ToString(SwapType swapType) const
+const char* IRSwap::ToString(SwapType swapType) const
 {
-	switch (swapType) {
-	case SPOT: return "Standard";
-	case FORWARD: return "Forward";
-	case IMM: return "IMM";
-	case MAC: return "MAC";
-	case BASIS: return "Basis";
-	default: return "";
-	}
+	return ToName(SWAP_TYPE_NAMES, swapType);
 }
 
-string IRSwap::ToString(SwapLegType swapLegType) const
+const char* IRSwap::ToString(SwapLegType swapLegType) const
 {
-	switch (swapLegType) {
-	case OUTRIGHT: return "Outright";
-	case CURVE: return "Curve";
-	case FLY: return "Fly";
-	default: return "";
-	}
+	return ToName(SWAP_LEG_TYPE_NAMES, swapLegType);
 }
 
 /*--------------------------- HW 2 ------------------------- */
 
-enum FutureDeliveryMethod { CASH, PHYSICAL };
+enum FutureDeliveryMethod : unsigned char { CASH, PHYSICAL };
+
+// Future delivery method names
+constexpr const char* FUTURE_DELIVERY_METHOD_NAMES[] = { "Cash", "Physical" };
 
 class Future : public Product
 {
 public:
 	// Future constructor
-	Future(string _productId, Product _underlyingProduct, date _maturityDate, double _notional, double _tickSize, string _ticker,
-		FutureDeliveryMethod _deliveryMethod) : Product(_productId, FUTURE)
-	{
-		underlyingProduct = _underlyingProduct;
-		maturityDate = _maturityDate;
-		notional = _notional;
-		tickSize = _tickSize;
-		ticker = _ticker;
-		deliveryMethod = _deliveryMethod;
-	};
+	Future(const string &_productId, const Product &_underlyingProduct, date _maturityDate, double _notional, double _tickSize, const string &_ticker,
+		FutureDeliveryMethod _deliveryMethod) : Product(_productId, FUTURE)
+	{
+		if (!Ticker::Fits(_ticker))
+			throw "Ticker too long";
+
+		underlyingProductId = _underlyingProduct.GetProductId();
+		underlyingProductType = _underlyingProduct.GetProductType();
+		maturityDate = _maturityDate;
+		notional = _notional;
+		tickSize = _tickSize;
+		ticker = _ticker;
+		deliveryMethod = _deliveryMethod;
+	};
+
+	Future() : Product() {};
+
+	const Ticker& GetTicker() const { return ticker; }
+	date GetMaturityDate() const { return maturityDate; }
+	Product GetUnderlydingProduct() const { return Product(underlyingProductId, underlyingProductType); }
+	const ProductId& GetUnderlyingProductId() const { return underlyingProductId; }
+	ProductType GetUnderlyingProductType() const { return underlyingProductType; }
+	double GetNotional() const { return notional; }
+	double GetTickSize() const { return tickSize; }
+	FutureDeliveryMethod GetDeliveryMethod() const { return deliveryMethod; }
 
-	Future() : Product() {};
+	// Return the nearest tick price of a price in points
+	TickPrice ToTickPrice(double price) const { return TickPrice::FromDouble(price, tickSize); }
 
-	string GetTicker() const { return ticker; }
-	date GetMaturityDate() const { return maturityDate; }
-	Product GetUnderlydingProduct() const { return underlyingProduct; }
+	// Return the price in points of a tick price
+	double ToPrice(TickPrice price) const { return price.ToDouble(tickSize); }
 
 private:
-	string productId; // product identifier variable
-	Product underlyingProduct; // underlying product
-	date maturityDate; // maturity date variable
+	// small fields first, right after the inline id of Product
+	FutureDeliveryMethod deliveryMethod; // cash or physical delivery
+	ProductType underlyingProductType; // type of the underlying product
+	date maturityDate; // maturity date variable, a 32-bit day number
 	double notional; // notional value of contract
 	double tickSize; // tick size - smallest increment a future can move
-	string ticker; // ticker of future in exchange
-	FutureDeliveryMethod deliveryMethod;
+	ProductId underlyingProductId; // id of the underlying product, held inline
+	Ticker ticker; // ticker of future in exchange, held inline
 };
 
 class FloatingInterestRate : public Product
 {
 public:
-	FloatingInterestRate(string _productId, int _tenor, FloatingIndex _floatingIndex, double _spread) : Product(_productId, INTEREST_RATE)
+	FloatingInterestRate(const string &_productId, int _tenor, FloatingIndex _floatingIndex, double _spread) : Product(_productId, INTEREST_RATE)
 	{
 		tenor = _tenor;
 		floatingIndex = _floatingIndex;
@@ -443,11 +471,43 @@ public:
 		if (_underlyingInstrument.GetProductType() != BOND)
 			throw "Must pass a bond product";
 
-		priceQuote = _priceQuote;
+		deliverableBondIds.push_back(_underlyingInstrument.GetProductId());
+		price = ParseTreasuryQuote(_priceQuote, _tickSize);
+	}
+
+	// BondFuture ctor over a basket of deliverable bonds, referenced by their product id in the BondProductService.
+	// The first deliverable is used as the underlying product.
+	BondFuture(string _productId, vector<string> _deliverableBondIds, date _maturityDate, double _notional, double _tickSize, string _ticker, string _priceQuote)
+		: Future(_productId, Product(_deliverableBondIds.empty() ? string() : _deliverableBondIds.front(), BOND), _maturityDate, _notional, _tickSize, _ticker, PHYSICAL)
+	{
+		if (_deliverableBondIds.empty())
+			throw "Must pass at least one deliverable bond";
+
+		deliverableBondIds = _deliverableBondIds;
+		price = ParseTreasuryQuote(_priceQuote, _tickSize);
+	}
+
+	// Return the product identifiers of the deliverable bonds
+	const vector<string>& GetDeliverableBondIds() const { return deliverableBondIds; }
+
+	// Return the price in ticks
+	TickPrice GetPrice() const { return price; }
+
+	// Return the price quoted in 32nds (e.g. "158-15")
+	string GetPriceQuote() const { return FormatTreasuryQuote(price, GetTickSize()); }
+
+	// Return the heap bytes held by the future outside its object, including its deliverable basket
+	size_t GetHeapBytes() const
+	{
+		size_t bytes = Future::GetHeapBytes() + deliverableBondIds.capacity() * sizeof(string);
+		for (size_t i = 0; i < deliverableBondIds.size(); ++i)
+			bytes += GetStringHeapBytes(deliverableBondIds[i]);
+		return bytes;
 	}
 
 private:
-	string priceQuote;
+	vector<string> deliverableBondIds; // deliverable basket
+	TickPrice price; // price in ticks
 };
 
 // A Eurodollar future is a cash settled futures contract 
@@ -462,11 +522,17 @@ public:
 		if (_underlyingInstrument.GetProductType() != INTEREST_RATE)
 			throw "Must pass a interest rate product";
 
-		priceQuote = _priceQuote;
+		price = ToTickPrice(_priceQuote);
 	}
 
+	// Return the price in ticks
+	TickPrice GetPrice() const { return price; }
+
+	// Return the price in points
+	double GetPriceQuote() const { return ToPrice(price); }
+
 private:
-	double priceQuote;
+	TickPrice price; // price in ticks
 };
 
 #endif
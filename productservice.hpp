@@ -2,15 +2,49 @@
 * productservice.hpp defines Bond and IRSwap ProductServices
 */
 
+#ifndef PRODUCTSERVICE_HPP
+#define PRODUCTSERVICE_HPP
+
 #include <iostream>
 #include <functional>
 #include <map>
+#include <tuple>
+#include <utility>
 #include "products.hpp"
+#include "nodepool.hpp"
+#include "productexport.hpp"
 #include "soa.hpp"
+#include "versionedstore.hpp"
+
+// Field names of the exported products, in export order
+const char* const BOND_EXPORT_FIELDS[] = { "productId", "bondIdType", "ticker", "coupon", "maturityDate" };
+const char* const IRSWAP_EXPORT_FIELDS[] = { "productId", "fixedLegDayCountConvention", "floatingLegDayCountConvention", "fixedLegPaymentFrequency", "floatingIndex", "floatingIndexTenor", "effectiveDate", "terminationDate", "currency", "termYears", "swapType", "swapLegType" };
+const char* const FUTURE_EXPORT_FIELDS[] = { "productId", "ticker", "underlyingProductId", "underlyingProductType", "maturityDate", "notional", "tickSize", "deliveryMethod" };
+
+// Edit id owning every node of the future map: futures are never published as versions, so
+// the map is updated in place like an ordinary tree
+const unsigned long FUTURE_MAP_EDIT = 1;
+
+/**
+* Snapshot of the bonds of a BondProductService at one version
+*/
+class BondSnapshot : public ProductSnapshot<Bond>
+{
+public:
+	// BondSnapshot ctor
+	explicit BondSnapshot(const VersionPtr &version) : ProductSnapshot<Bond>(version) {}
+
+	// Get all Bonds with the specified ticker
+	vector<Bond> GetBonds(const string &_ticker) const
+	{
+		return Filter([&_ticker](const Bond &b)->bool { return b.GetTicker() == _ticker; });
+	}
+};
 
 /**
 * Bond Product Service to own reference data over a set of bond securities.
 * Key is the productId string, value is a Bond.
+* Every update publishes a new version of the bonds; GetSnapshot() pins a version for lock-free queries.
 */
 class BondProductService : public Service<string, Bond>
 {
@@ -20,22 +54,117 @@ public:
 	BondProductService();
 
 	// Return the bond data for a particular bond product identifier
-	Bond& GetData(string productId);
+	const Bond& GetData(string productId);
+
+	// Return the bond for a product identifier, or null when there is none
+	const Bond* Find(const string &productId);
+
+	// Add a bond to the service (convenience method), replacing any bond with the same identifier
+	void Add(const Bond &bond);
+
+	// Move a bond into the service
+	void Add(Bond &&bond);
+
+	// Construct a bond in place from its constructor arguments and return it
+	template<typename... Args>
+	const Bond& Emplace(const string &productId, Args&&... args);
+
+	// Remove a bond, returning false when there is none
+	bool Remove(string productId);
+
+	// Publish the updates between BeginBatch() and EndBatch() as one version
+	void BeginBatch();
+	void EndBatch();
+
+	// Return the latest version number
+	size_t GetVersion() const;
+
+	// Return the stored bond for a product identifier in the latest state, or an empty pointer when there is none
+	shared_ptr<const StoredProduct<Bond> > FindStored(const string &productId) const;
+
+	// Pin the latest version, or a version from the history
+	BondSnapshot GetSnapshot() const;
+	BondSnapshot GetSnapshot(size_t version) const;
+
+	// Drop the versions before the given one from the history
+	void ReleaseHistory(size_t version);
+
+	// Return the memory taken by the bonds and their index
+	MemoryUsage GetMemoryUsage() const;
 
-	// Add a bond to the service (convenience method)
-	void Add(Bond &bond);
+	// Reserve pool memory for count more bonds
+	void Reserve(size_t count);
+
+	// Remove all bonds and versions and release their memory back to the pool (e.g. before a reload)
+	void Clear();
 
 	// Get all Bonds with the specified ticker
 	vector<Bond> GetBonds(string& _ticker);
 
+	// Export all bonds to the buffer
+	void Export(ExportBuffer &buffer) const;
+
 private:
-	map<string, Bond> bondMap; // cache of bond products
+	VersionedProductStore<Bond> bondStore; // versions of the bond products
 
 };
 
+/**
+* Snapshot of the swaps of an IRSwapProductService at one version
+*/
+class IRSwapSnapshot : public ProductSnapshot<IRSwap>
+{
+public:
+	// IRSwapSnapshot ctor
+	explicit IRSwapSnapshot(const VersionPtr &version) : ProductSnapshot<IRSwap>(version) {}
+
+	// Get all Swaps with the specified fixed leg day count convention
+	vector<IRSwap> GetSwaps(DayCountConvention _fixedLegDayCountConvention) const
+	{
+		return Filter([_fixedLegDayCountConvention](const IRSwap &s)->bool { return s.GetFixedLegDayCountConvention() == _fixedLegDayCountConvention; });
+	}
+
+	// Get all Swaps with the specified fixed leg payment frequency
+	vector<IRSwap> GetSwaps(PaymentFrequency _fixedLegPaymentFrequency) const
+	{
+		return Filter([_fixedLegPaymentFrequency](const IRSwap &s)->bool { return s.GetFixedLegPaymentFrequency() == _fixedLegPaymentFrequency; });
+	}
+
+	// Get all Swaps with the specified floating index
+	vector<IRSwap> GetSwaps(FloatingIndex _floatingIndex) const
+	{
+		return Filter([_floatingIndex](const IRSwap &s)->bool { return s.GetFloatingIndex() == _floatingIndex; });
+	}
+
+	// Get all Swaps with a term in years greater than the specified value
+	vector<IRSwap> GetSwapsGreaterThan(int _termYears) const
+	{
+		return Filter([_termYears](const IRSwap &s)->bool { return s.GetTermYears() >= _termYears; });
+	}
+
+	// Get all Swaps with a term in years less than the specified value
+	vector<IRSwap> GetSwapsLessThan(int _termYears) const
+	{
+		return Filter([_termYears](const IRSwap &s)->bool { return s.GetTermYears() < _termYears; });
+	}
+
+	// Get all Swaps with the specified swap type
+	vector<IRSwap> GetSwaps(SwapType _swapType) const
+	{
+		return Filter([_swapType](const IRSwap &s)->bool { return s.GetSwapType() == _swapType; });
+	}
+
+	// Get all Swaps with the specified swap leg type
+	vector<IRSwap> GetSwaps(SwapLegType _swapLegType) const
+	{
+		return Filter([_swapLegType](const IRSwap &s)->bool { return s.GetSwapLegType() == _swapLegType; });
+	}
+};
+
 /**
 * Interest Rate Swap Product Service to own reference data over a set of IR Swap products
 * Key is the productId string, value is a IRSwap.
+* Every update publishes a new version of the swaps; GetSnapshot() pins a version for lock-free queries.
 */
 class IRSwapProductService : public Service<string, IRSwap>
 {
@@ -44,10 +173,49 @@ public:
 	IRSwapProductService();
 
 	// Return the IR Swap data for a particular bond product identifier
-	IRSwap& GetData(string productId);
+	const IRSwap& GetData(string productId);
+
+	// Return the IR Swap for a product identifier, or null when there is none
+	const IRSwap* Find(const string &productId);
+
+	// Add a bond to the service (convenience method), replacing any swap with the same identifier
+	void Add(const IRSwap &swap);
+
+	// Move a swap into the service
+	void Add(IRSwap &&swap);
+
+	// Construct a swap in place from its constructor arguments and return it
+	template<typename... Args>
+	const IRSwap& Emplace(const string &productId, Args&&... args);
+
+	// Remove a swap, returning false when there is none
+	bool Remove(string productId);
+
+	// Publish the updates between BeginBatch() and EndBatch() as one version
+	void BeginBatch();
+	void EndBatch();
+
+	// Return the latest version number
+	size_t GetVersion() const;
+
+	// Return the stored swap for a product identifier in the latest state, or an empty pointer when there is none
+	shared_ptr<const StoredProduct<IRSwap> > FindStored(const string &productId) const;
+
+	// Pin the latest version, or a version from the history
+	IRSwapSnapshot GetSnapshot() const;
+	IRSwapSnapshot GetSnapshot(size_t version) const;
+
+	// Drop the versions before the given one from the history
+	void ReleaseHistory(size_t version);
+
+	// Return the memory taken by the swaps and their index
+	MemoryUsage GetMemoryUsage() const;
+
+	// Reserve pool memory for count more swaps
+	void Reserve(size_t count);
 
-	// Add a bond to the service (convenience method)
-	void Add(IRSwap &swap);
+	// Remove all swaps and versions and release their memory back to the pool (e.g. before a reload)
+	void Clear();
 
 	// Get all Swaps with the specified fixed leg day count convention
 	vector<IRSwap> GetSwaps(DayCountConvention _fixedLegDayCountConvention);
@@ -70,104 +238,269 @@ public:
 	// Get all Swaps with the specified swap leg type
 	vector<IRSwap> GetSwaps(SwapLegType _swapLegType);
 
-private:
-	map<string, IRSwap> swapMap; // cache of IR Swap products
-
-	vector<IRSwap> GetSwaps(std::function<bool(IRSwap)> filterFunc)
-	{
-		std::vector<IRSwap> swaps;
-		// show content:
-		for (std::map<string, IRSwap>::iterator it = swapMap.begin(); it != swapMap.end(); ++it)
-			if (filterFunc(it->second))
-				swaps.push_back(it->second);
+	// Export all swaps to the buffer
+	void Export(ExportBuffer &buffer) const;
 
-		return swaps;
-	}
+private:
+	VersionedProductStore<IRSwap> swapStore; // versions of the IR Swap products
 };
 
 /*---------------------- Bond Service start ---------------------*/
 BondProductService::BondProductService()
 {
-	bondMap = map<string, Bond>();
 }
 
-Bond& BondProductService::GetData(string productId)
+const Bond& BondProductService::GetData(string productId)
+{
+	const Bond *bond = Find(productId);
+	if (!bond)
+		throw "Bond not found";
+
+	return *bond;
+}
+
+const Bond* BondProductService::Find(const string &productId)
+{
+	return bondStore.Find(productId);
+}
+
+void BondProductService::Add(const Bond &bond)
+{
+	bondStore.Add(bond);
+}
+
+void BondProductService::Add(Bond &&bond)
+{
+	bondStore.Add(std::move(bond));
+}
+
+template<typename... Args>
+const Bond& BondProductService::Emplace(const string &productId, Args&&... args)
+{
+	return bondStore.Emplace(productId, std::forward<Args>(args)...);
+}
+
+bool BondProductService::Remove(string productId)
+{
+	return bondStore.Remove(productId);
+}
+
+void BondProductService::BeginBatch()
+{
+	bondStore.BeginBatch();
+}
+
+void BondProductService::EndBatch()
+{
+	bondStore.EndBatch();
+}
+
+size_t BondProductService::GetVersion() const
+{
+	return bondStore.GetLatest()->version;
+}
+
+shared_ptr<const StoredProduct<Bond> > BondProductService::FindStored(const string &productId) const
+{
+	return bondStore.FindStored(productId);
+}
+
+BondSnapshot BondProductService::GetSnapshot() const
+{
+	return BondSnapshot(bondStore.GetLatest());
+}
+
+BondSnapshot BondProductService::GetSnapshot(size_t version) const
+{
+	return BondSnapshot(bondStore.GetVersion(version));
+}
+
+void BondProductService::ReleaseHistory(size_t version)
+{
+	bondStore.ReleaseHistory(version);
+}
+
+MemoryUsage BondProductService::GetMemoryUsage() const
+{
+	return bondStore.GetMemoryUsage();
+}
+
+void BondProductService::Reserve(size_t count)
 {
-	return bondMap[productId];
+	bondStore.Reserve(count);
 }
 
-void BondProductService::Add(Bond &bond)
+void BondProductService::Clear()
 {
-	bondMap.insert(pair<string, Bond>(bond.GetProductId(), bond));
+	bondStore.Clear();
 }
 
 vector<Bond> BondProductService::GetBonds(string& _ticker)
 {
-	std::vector<Bond> bonds;
-	for (std::map<string, Bond>::iterator it = bondMap.begin(); it != bondMap.end(); ++it)
-		if (it->second.GetTicker() == _ticker)
-			bonds.push_back(it->second);
+	return GetSnapshot().GetBonds(_ticker);
+}
 
-	return bonds;
+void BondProductService::Export(ExportBuffer &buffer) const
+{
+	buffer.AddHeader(BOND_EXPORT_FIELDS, sizeof(BOND_EXPORT_FIELDS) / sizeof(BOND_EXPORT_FIELDS[0]));
+	GetSnapshot().ForEach([&buffer](const Bond &bond)
+	{
+		buffer.BeginRecord();
+		buffer.AddField(BOND_EXPORT_FIELDS[0], bond.GetProductId());
+		buffer.AddField(BOND_EXPORT_FIELDS[1], ToName(BOND_ID_TYPE_NAMES, bond.GetBondIdType()));
+		buffer.AddField(BOND_EXPORT_FIELDS[2], bond.GetTicker());
+		buffer.AddField(BOND_EXPORT_FIELDS[3], (double)bond.GetCoupon(), 6);
+		buffer.AddField(BOND_EXPORT_FIELDS[4], bond.GetMaturityDate());
+		buffer.EndRecord();
+	});
 }
 /*--------------------- Bond Service End --------------------------*/
 
 /*--------------------- IR SWAP Service start --------------------- */
 IRSwapProductService::IRSwapProductService()
 {
-	swapMap = map<string, IRSwap>();
 }
 
-IRSwap& IRSwapProductService::GetData(string productId)
+const IRSwap& IRSwapProductService::GetData(string productId)
+{
+	const IRSwap *swap = Find(productId);
+	if (!swap)
+		throw "IR Swap not found";
+
+	return *swap;
+}
+
+const IRSwap* IRSwapProductService::Find(const string &productId)
+{
+	return swapStore.Find(productId);
+}
+
+void IRSwapProductService::Add(const IRSwap &swap)
+{
+	swapStore.Add(swap);
+}
+
+void IRSwapProductService::Add(IRSwap &&swap)
+{
+	swapStore.Add(std::move(swap));
+}
+
+template<typename... Args>
+const IRSwap& IRSwapProductService::Emplace(const string &productId, Args&&... args)
+{
+	return swapStore.Emplace(productId, std::forward<Args>(args)...);
+}
+
+bool IRSwapProductService::Remove(string productId)
+{
+	return swapStore.Remove(productId);
+}
+
+void IRSwapProductService::BeginBatch()
+{
+	swapStore.BeginBatch();
+}
+
+void IRSwapProductService::EndBatch()
+{
+	swapStore.EndBatch();
+}
+
+size_t IRSwapProductService::GetVersion() const
+{
+	return swapStore.GetLatest()->version;
+}
+
+shared_ptr<const StoredProduct<IRSwap> > IRSwapProductService::FindStored(const string &productId) const
 {
-	return swapMap[productId];
+	return swapStore.FindStored(productId);
 }
 
-void IRSwapProductService::Add(IRSwap &swap)
+IRSwapSnapshot IRSwapProductService::GetSnapshot() const
 {
-	swapMap.insert(pair<string, IRSwap>(swap.GetProductId(), swap));
+	return IRSwapSnapshot(swapStore.GetLatest());
+}
+
+IRSwapSnapshot IRSwapProductService::GetSnapshot(size_t version) const
+{
+	return IRSwapSnapshot(swapStore.GetVersion(version));
+}
+
+void IRSwapProductService::ReleaseHistory(size_t version)
+{
+	swapStore.ReleaseHistory(version);
+}
+
+MemoryUsage IRSwapProductService::GetMemoryUsage() const
+{
+	return swapStore.GetMemoryUsage();
+}
+
+void IRSwapProductService::Reserve(size_t count)
+{
+	swapStore.Reserve(count);
+}
+
+void IRSwapProductService::Clear()
+{
+	swapStore.Clear();
 }
 
 vector<IRSwap> IRSwapProductService::GetSwaps(DayCountConvention _fixedLegDayCountConvention)
 {
-	std::function<bool(IRSwap)> func = [_fixedLegDayCountConvention](IRSwap s)->bool { return s.GetFixedLegDayCountConvention() == _fixedLegDayCountConvention; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwaps(_fixedLegDayCountConvention);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwaps(PaymentFrequency _fixedLegPaymentFrequency) 
 {
-	std::function<bool(IRSwap)> func = [_fixedLegPaymentFrequency](IRSwap s)->bool { return s.GetFixedLegPaymentFrequency() == _fixedLegPaymentFrequency; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwaps(_fixedLegPaymentFrequency);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwaps(FloatingIndex _floatingIndex)
 {
-	std::function<bool(IRSwap)> func = [_floatingIndex](IRSwap s)->bool { return s.GetFloatingIndex() == _floatingIndex; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwaps(_floatingIndex);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwapsGreaterThan(int _termYears)
 {
-	std::function<bool(IRSwap)> func = [_termYears](IRSwap s)->bool { return s.GetTermYears() >= _termYears; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwapsGreaterThan(_termYears);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwapsLessThan(int _termYears)
 {
-	std::function<bool(IRSwap)> func = [_termYears](IRSwap s)->bool { return s.GetTermYears() < _termYears; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwapsLessThan(_termYears);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwaps(SwapType _swapType)
 {
-	std::function<bool(IRSwap)> func = [_swapType](IRSwap s)->bool { return s.GetSwapType() == _swapType; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwaps(_swapType);
 }
 
 vector<IRSwap> IRSwapProductService::GetSwaps(SwapLegType _swapLegType)
 {
-	std::function<bool(IRSwap)> func = [_swapLegType](IRSwap s)->bool { return s.GetSwapLegType() == _swapLegType; };
-	return GetSwaps(func);
+	return GetSnapshot().GetSwaps(_swapLegType);
+}
+
+void IRSwapProductService::Export(ExportBuffer &buffer) const
+{
+	buffer.AddHeader(IRSWAP_EXPORT_FIELDS, sizeof(IRSWAP_EXPORT_FIELDS) / sizeof(IRSWAP_EXPORT_FIELDS[0]));
+	GetSnapshot().ForEach([&buffer](const IRSwap &swap)
+	{
+		buffer.BeginRecord();
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[0], swap.GetProductId());
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[1], ToName(DAY_COUNT_CONVENTION_NAMES, swap.GetFixedLegDayCountConvention()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[2], ToName(DAY_COUNT_CONVENTION_NAMES, swap.GetFloatingLegDayCountConvention()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[3], ToName(PAYMENT_FREQUENCY_NAMES, swap.GetFixedLegPaymentFrequency()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[4], ToName(FLOATING_INDEX_NAMES, swap.GetFloatingIndex()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[5], ToName(FLOATING_INDEX_TENOR_NAMES, swap.GetFloatingIndexTenor()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[6], swap.GetEffectiveDate());
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[7], swap.GetTerminationDate());
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[8], ToName(CURRENCY_NAMES, swap.GetCurrency()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[9], (long long)swap.GetTermYears());
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[10], ToName(SWAP_TYPE_NAMES, swap.GetSwapType()));
+		buffer.AddField(IRSWAP_EXPORT_FIELDS[11], ToName(SWAP_LEG_TYPE_NAMES, swap.GetSwapLegType()));
+		buffer.EndRecord();
+	});
 }
 
 /*--------------------- IR SWAP Service end --------------------- */
@@ -175,16 +508,125 @@ vector<IRSwap> IRSwapProductService::GetSwaps(SwapLegType _swapLegType)
 /*--------------------- Future Service start --------------------- */
 /**
 * Future Product Service to own reference data over a set of futures.
-* Key is the productId string, value is a Bond.
+* Key is the productId string, value is a Future.
+* Futures are held in a PersistentMap drawn from the service's pool, keyed by the id inside
+* each future, so no node holds a second copy of the id.
 */
 class FutureProductService : public Service<string, Future>
 {
 public:
-	FutureProductService() { futureMap = map<string, Future>(); };
-	void Add(Future future) { futureMap.insert(pair<string, Future>(future.GetProductId(), future)); }
+	FutureProductService() : pool(make_shared<NodePool>()) {};
+
+	// Add a future to the service, replacing any future with the same identifier
+	void Add(const Future &future) { Insert(allocate_shared<StoredFuture>(SharedPoolAllocator<StoredFuture>(pool), future)); }
+
+	// Move a future into the service
+	void Add(Future &&future) { Insert(allocate_shared<StoredFuture>(SharedPoolAllocator<StoredFuture>(pool), std::move(future))); }
 
-	Future& GetData(string productId) { return futureMap[productId]; }
+	// Construct a future in place from its constructor arguments, replacing any future with the same identifier, and return it
+	template<typename... Args>
+	const Future& Emplace(const string &productId, Args&&... args)
+	{
+		shared_ptr<StoredFuture> value = allocate_shared<StoredFuture>(SharedPoolAllocator<StoredFuture>(pool), productId, std::forward<Args>(args)...);
+		Insert(value);
+		return value->product;
+	}
+
+	// Remove a future, returning its memory to the pool; false when there is none
+	bool Remove(string productId)
+	{
+		shared_ptr<StoredFuture> removed;
+		futureMap = futureMap.Erase(productId, FUTURE_MAP_EDIT, pool, removed);
+		if (!removed)
+			return false;
+
+		removed->replaced = true;
+		return true;
+	}
+
+	// Reserve pool memory for count more futures
+	void Reserve(size_t count) { pool->Reserve(count * (NodePool::GetBlockSize(sizeof(StoredFuture) + SHARED_BLOCK_OVERHEAD) + NodePool::GetBlockSize(sizeof(FutureMap::Node) + SHARED_BLOCK_OVERHEAD))); }
+
+	// Return the memory taken by the futures and their map
+	MemoryUsage GetMemoryUsage() const
+	{
+		const size_t futureBlock = NodePool::GetBlockSize(sizeof(StoredFuture) + SHARED_BLOCK_OVERHEAD);
+
+		MemoryUsage usage;
+		usage.count = futureMap.GetSize();
+		usage.indexBytes = usage.count * NodePool::GetBlockSize(sizeof(FutureMap::Node) + SHARED_BLOCK_OVERHEAD);
+		futureMap.ForEach([&usage, futureBlock](const StoredFuture &stored) { usage.payloadBytes += futureBlock + stored.product.GetHeapBytes(); });
+		usage.reservedBytes = pool->GetBytesReserved();
+		return usage;
+	}
+
+	// Remove all futures and release their memory back to the pool (e.g. before a reload)
+	void Clear()
+	{
+		futureMap.ForEach([](const StoredFuture &stored) { stored.replaced = true; });
+		futureMap = FutureMap();
+
+		// futures still referenced elsewhere keep the old pool alive
+		if (pool.use_count() == 1)
+			pool->Reset();
+		else
+			pool = make_shared<NodePool>();
+	}
+
+	const Future& GetData(string productId)
+	{
+		const Future *future = Find(productId);
+		if (!future)
+			throw "Future not found";
+
+		return *future;
+	}
+
+	// Return the future for a product identifier, or null when there is none
+	const Future* Find(const string &productId) const
+	{
+		const StoredFuture *stored = futureMap.Find(productId);
+		return stored ? &stored->product : 0;
+	}
+
+	// Return the stored future for a product identifier, or an empty pointer when there is none
+	shared_ptr<const StoredProduct<Future> > FindStored(const string &productId) const { return futureMap.FindShared(productId); }
+
+	// Export all futures to the buffer
+	void Export(ExportBuffer &buffer) const
+	{
+		buffer.AddHeader(FUTURE_EXPORT_FIELDS, sizeof(FUTURE_EXPORT_FIELDS) / sizeof(FUTURE_EXPORT_FIELDS[0]));
+		futureMap.ForEach([&buffer](const StoredFuture &stored)
+		{
+			const Future &future = stored.product;
+			buffer.BeginRecord();
+			buffer.AddField(FUTURE_EXPORT_FIELDS[0], future.GetProductId());
+			buffer.AddField(FUTURE_EXPORT_FIELDS[1], future.GetTicker());
+			buffer.AddField(FUTURE_EXPORT_FIELDS[2], future.GetUnderlyingProductId());
+			buffer.AddField(FUTURE_EXPORT_FIELDS[3], ToName(PRODUCT_TYPE_NAMES, future.GetUnderlyingProductType()));
+			buffer.AddField(FUTURE_EXPORT_FIELDS[4], future.GetMaturityDate());
+			buffer.AddField(FUTURE_EXPORT_FIELDS[5], future.GetNotional(), 2);
+			buffer.AddField(FUTURE_EXPORT_FIELDS[6], future.GetTickSize(), 9);
+			buffer.AddField(FUTURE_EXPORT_FIELDS[7], ToName(FUTURE_DELIVERY_METHOD_NAMES, future.GetDeliveryMethod()));
+			buffer.EndRecord();
+		});
+	}
 protected:
-	map<string, Future> futureMap; // cache product
+	typedef StoredProduct<Future> StoredFuture;
+	typedef PersistentMap<ProductId, StoredFuture> FutureMap;
+
+	shared_ptr<NodePool> pool; // memory for the futures and their map nodes
+	FutureMap futureMap; // cache product
+
+	// Insert a future into the map, flagging the future it replaces
+	void Insert(const shared_ptr<StoredFuture> &future)
+	{
+		shared_ptr<StoredFuture> displaced;
+		futureMap = futureMap.Insert(future, FUTURE_MAP_EDIT, pool, displaced);
+		if (displaced)
+			displaced->replaced = true;
+	}
 };
 /*--------------------- Future Service end --------------------- */
+
+#endif
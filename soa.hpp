@@ -14,7 +14,10 @@ class Service
 {
 public:
 	// 
-	virtual V& GetData(K key) = 0;
+	virtual const V& GetData(K key) = 0;
+
+	// Remove the value for a key, returning false when there is none
+	virtual bool Remove(K key) = 0;
 };
 
 #endif
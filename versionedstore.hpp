@@ -0,0 +1,610 @@
+/**
+* versionedstore.hpp defines a persistent (structurally shared) map and a versioned
+* product store over it, with immutable snapshots for as-of queries
+*/
+
+#ifndef VERSIONEDSTORE_HPP
+#define VERSIONEDSTORE_HPP
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "fixedstring.hpp"
+#include "memoryusage.hpp"
+#include "nodepool.hpp"
+
+using namespace std;
+
+// Approximate bytes of a shared_ptr control block allocated with its object (vtable, counts, shared pool allocator)
+const size_t SHARED_BLOCK_OVERHEAD = 4 * sizeof(void*);
+
+/**
+* Product as held by a product store, with a flag the store raises once it replaces or removes
+* the product. Holders sharing the product can tell whether it is still current without looking
+* its id up again. The flag is only written and read on the thread writing to the store.
+*/
+template<typename V>
+struct StoredProduct
+{
+	V product; // the product, read only once stored
+	mutable bool replaced; // raised by the store when the product is replaced or removed
+
+	// StoredProduct ctor, constructing the product from its arguments
+	template<typename... Args>
+	explicit StoredProduct(Args&&... args) : product(std::forward<Args>(args)...), replaced(false) {}
+
+	// Return the product id, the key of the product in its store
+	const ProductId& GetProductId() const { return product.GetProductId(); }
+};
+
+/**
+* Persistent map, implemented as a treap with path copying.
+* Insert returns a new map sharing all untouched nodes with the old one, so every version
+* costs O(log n) new nodes. Nodes stamped with the edit id of an unpublished update are
+* owned by that update and changed in place, so a batch of inserts copies each node once.
+* Values are held by shared_ptr and never copied between versions. Nodes hold no copy of
+* their key: it is the product id of their value, of type K, and lookups compare the id
+* in place with any key type ordered against K.
+* Nodes are drawn from a pool they share ownership of, so a map outliving its store stays valid.
+*/
+template<typename K, typename V>
+class PersistentMap
+{
+public:
+	struct Node;
+	typedef shared_ptr<Node> NodePtr;
+
+	struct Node
+	{
+		shared_ptr<V> value; // value, shared by every version holding it, and holding the key
+		NodePtr left; // subtree of smaller keys
+		NodePtr right; // subtree of larger keys
+		size_t priority; // heap priority, a hash of the key
+		unsigned long edit; // id of the update which owns the node
+
+		Node(const shared_ptr<V> &_value, const NodePtr &_left, const NodePtr &_right, size_t _priority, unsigned long _edit)
+			: value(_value), left(_left), right(_right), priority(_priority), edit(_edit) {}
+
+		// Return the key of the node, the product id of its value
+		const K& GetKey() const { return value->GetProductId(); }
+	};
+
+	// PersistentMap ctor
+	PersistentMap() : size(0) {}
+
+	// Return the value of a key, or null when there is none. Values are shared between versions and read only.
+	template<typename Key>
+	const V* Find(const Key &key) const;
+
+	// Return the shared value of a key, or an empty pointer when there is none
+	template<typename Key>
+	shared_ptr<const V> FindShared(const Key &key) const;
+
+	// Return the number of keys
+	size_t GetSize() const { return size; }
+
+	// Call f on every value in key order
+	template<typename F>
+	void ForEach(F f) const { ForEach(root, f); }
+
+	// Return a map with the key of value set to value, and the value it replaces in displaced; nodes owned by edit are updated in place
+	PersistentMap Insert(const shared_ptr<V> &value, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced) const;
+
+	// Return a map without the key, and the value removed in displaced; nodes owned by edit are updated in place
+	template<typename Key>
+	PersistentMap Erase(const Key &key, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced) const;
+
+private:
+	NodePtr root; // root of the treap
+	size_t size; // number of keys
+
+	PersistentMap(const NodePtr &_root, size_t _size) : root(_root), size(_size) {}
+
+	// Return the node itself when owned by edit, otherwise a copy owned by edit
+	static NodePtr Own(const NodePtr &node, unsigned long edit, const shared_ptr<NodePool> &pool);
+
+	static NodePtr Insert(const NodePtr &node, const K &key, const shared_ptr<V> &value, size_t priority, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced);
+
+	template<typename Key>
+	static NodePtr Erase(const NodePtr &node, const Key &key, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced);
+
+	// Join two treaps whose keys are all smaller in the first one
+	static NodePtr Merge(const NodePtr &left, const NodePtr &right, unsigned long edit, const shared_ptr<NodePool> &pool);
+
+	template<typename F>
+	static void ForEach(const NodePtr &node, F &f);
+};
+
+/**
+* One published version of a product store
+*/
+template<typename V>
+struct ProductVersion
+{
+	size_t version; // version number, 0 for the empty store
+	PersistentMap<ProductId, StoredProduct<V> > products; // products keyed by product id
+
+	ProductVersion(size_t _version, const PersistentMap<ProductId, StoredProduct<V> > &_products) : version(_version), products(_products) {}
+};
+
+/**
+* Immutable snapshot of a product store at one version.
+* Queries on a snapshot take no locks and are unaffected by later updates of the store.
+*/
+template<typename V>
+class ProductSnapshot
+{
+public:
+	typedef shared_ptr<const ProductVersion<V> > VersionPtr;
+
+	// ProductSnapshot ctor
+	explicit ProductSnapshot(const VersionPtr &_version) : version(_version) {}
+
+	// Return the version number of the snapshot
+	size_t GetVersion() const { return version->version; }
+
+	// Return the product for a product identifier
+	const V& GetData(const string &productId) const
+	{
+		const V *product = Find(productId);
+		if (!product)
+			throw "Product not found";
+
+		return *product;
+	}
+
+	// Return the product for a product identifier, or null when there is none
+	const V* Find(const string &productId) const
+	{
+		const StoredProduct<V> *stored = version->products.Find(productId);
+		return stored ? &stored->product : 0;
+	}
+
+	// Return the product shared with the store, or an empty pointer when there is none
+	shared_ptr<const V> FindShared(const string &productId) const
+	{
+		shared_ptr<const StoredProduct<V> > stored = version->products.FindShared(productId);
+		return stored ? shared_ptr<const V>(stored, &stored->product) : shared_ptr<const V>();
+	}
+
+	// Return the number of products
+	size_t GetSize() const { return version->products.GetSize(); }
+
+	// Call f on every product in product id order
+	template<typename F>
+	void ForEach(F f) const { version->products.ForEach([&f](const StoredProduct<V> &stored) { f(stored.product); }); }
+
+protected:
+	// Return all products matching a filter
+	vector<V> Filter(std::function<bool(const V&)> filterFunc) const
+	{
+		vector<V> products;
+		ForEach([&products, &filterFunc](const V &product) { if (filterFunc(product)) products.push_back(product); });
+		return products;
+	}
+
+private:
+	VersionPtr version; // pinned version
+};
+
+/**
+* Versioned store of products keyed by product id.
+* Every Add or Remove publishes a new version, or, inside BeginBatch()/EndBatch(), every batch does.
+* Published versions are kept in a history for as-of queries until released, and share
+* all unchanged nodes, so memory grows with the number of changes rather than with the
+* number of versions times the number of products.
+* Updates are expected from a single writer; snapshots may be pinned from any thread.
+*/
+template<typename V>
+class VersionedProductStore
+{
+public:
+	typedef typename ProductSnapshot<V>::VersionPtr VersionPtr;
+
+	// VersionedProductStore ctor
+	VersionedProductStore();
+
+	// Return the product for a product identifier in the latest state, or null when there is none.
+	// Products are shared with the published versions, so they are replaced through Add, never changed in place.
+	const V* Find(const string &productId) const;
+
+	// Return the stored product for a product identifier in the latest state, or an empty pointer when there is none.
+	// Its replaced flag is raised once the store replaces or removes it.
+	shared_ptr<const StoredProduct<V> > FindStored(const string &productId) const;
+
+	// Add a product, replacing any product with the same identifier
+	void Add(const V &product);
+	void Add(V &&product);
+
+	// Construct a product in place from its constructor arguments, replacing any product with the same identifier
+	template<typename... Args>
+	const V& Emplace(const string &productId, Args&&... args);
+
+	// Remove a product, returning false when there is none
+	bool Remove(const string &productId);
+
+	// Group the following updates into a single version, published by EndBatch()
+	void BeginBatch();
+	void EndBatch();
+
+	// Return the latest published version
+	VersionPtr GetLatest() const;
+
+	// Return a published version from the history
+	VersionPtr GetVersion(size_t version) const;
+
+	// Drop the versions before the given one from the history (snapshots pinned by callers stay valid)
+	void ReleaseHistory(size_t version);
+
+	// Reserve pool memory for count more products
+	void Reserve(size_t count);
+
+	// Return the memory taken by the latest state: the products, the tree nodes over them and the pool.
+	// Nodes and products kept alive only by older versions are counted in the pool bytes alone.
+	MemoryUsage GetMemoryUsage() const;
+
+	// Remove all products and versions (e.g. before a reload). The pool is reset for reuse when
+	// no snapshot is pinned; otherwise the store moves to a new pool, left to the pinned snapshots.
+	void Clear();
+
+private:
+	shared_ptr<NodePool> pool; // memory for nodes, products and versions, shared with every allocation from it
+	PersistentMap<ProductId, StoredProduct<V> > working; // latest state, ahead of the published version inside a batch
+	unsigned long edit; // id of the current, unpublished update
+	bool batching; // true between BeginBatch() and EndBatch()
+	size_t versionNumber; // number of the latest published version
+	VersionPtr latest; // latest published version, accessed atomically
+	vector<VersionPtr> history; // published versions by number, empty once released
+	mutable mutex historyMutex; // guards history
+
+	// Insert a product and publish it unless batching
+	void Insert(const shared_ptr<StoredProduct<V> > &product);
+
+	// Publish the working state as a new version
+	void Publish();
+};
+
+template<typename K, typename V>
+template<typename Key>
+const V* PersistentMap<K, V>::Find(const Key &key) const
+{
+	const Node *node = root.get();
+	while (node)
+	{
+		if (key < node->GetKey())
+			node = node->left.get();
+		else if (node->GetKey() < key)
+			node = node->right.get();
+		else
+			return node->value.get();
+	}
+
+	return 0;
+}
+
+template<typename K, typename V>
+template<typename Key>
+shared_ptr<const V> PersistentMap<K, V>::FindShared(const Key &key) const
+{
+	const Node *node = root.get();
+	while (node)
+	{
+		if (key < node->GetKey())
+			node = node->left.get();
+		else if (node->GetKey() < key)
+			node = node->right.get();
+		else
+			return node->value;
+	}
+
+	return shared_ptr<const V>();
+}
+
+template<typename K, typename V>
+PersistentMap<K, V> PersistentMap<K, V>::Insert(const shared_ptr<V> &value, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced) const
+{
+	displaced.reset();
+	const K &key = value->GetProductId();
+	NodePtr newRoot = Insert(root, key, value, std::hash<K>()(key), edit, pool, displaced);
+	return PersistentMap(newRoot, size + (displaced ? 0 : 1));
+}
+
+template<typename K, typename V>
+typename PersistentMap<K, V>::NodePtr PersistentMap<K, V>::Own(const NodePtr &node, unsigned long edit, const shared_ptr<NodePool> &pool)
+{
+	if (node->edit == edit)
+		return node;
+
+	return allocate_shared<Node>(SharedPoolAllocator<Node>(pool), node->value, node->left, node->right, node->priority, edit);
+}
+
+template<typename K, typename V>
+typename PersistentMap<K, V>::NodePtr PersistentMap<K, V>::Insert(const NodePtr &node, const K &key, const shared_ptr<V> &value, size_t priority, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced)
+{
+	if (!node)
+	{
+		return allocate_shared<Node>(SharedPoolAllocator<Node>(pool), value, NodePtr(), NodePtr(), priority, edit);
+	}
+
+	// the copied path is owned by edit, so rotations can relink it in place
+	NodePtr result = Own(node, edit, pool);
+	if (key < result->GetKey())
+	{
+		result->left = Insert(result->left, key, value, priority, edit, pool, displaced);
+		if (result->left->priority > result->priority)
+		{
+			NodePtr left = result->left;
+			result->left = left->right;
+			left->right = result;
+			result = left;
+		}
+	}
+	else if (result->GetKey() < key)
+	{
+		result->right = Insert(result->right, key, value, priority, edit, pool, displaced);
+		if (result->right->priority > result->priority)
+		{
+			NodePtr right = result->right;
+			result->right = right->left;
+			right->left = result;
+			result = right;
+		}
+	}
+	else
+	{
+		displaced = result->value;
+		result->value = value;
+	}
+
+	return result;
+}
+
+template<typename K, typename V>
+template<typename Key>
+PersistentMap<K, V> PersistentMap<K, V>::Erase(const Key &key, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced) const
+{
+	displaced.reset();
+	NodePtr newRoot = Erase(root, key, edit, pool, displaced);
+	if (!displaced)
+		return *this;
+
+	return PersistentMap(newRoot, size - 1);
+}
+
+template<typename K, typename V>
+template<typename Key>
+typename PersistentMap<K, V>::NodePtr PersistentMap<K, V>::Erase(const NodePtr &node, const Key &key, unsigned long edit, const shared_ptr<NodePool> &pool, shared_ptr<V> &displaced)
+{
+	if (!node)
+		return node;
+
+	if (key < node->GetKey())
+	{
+		NodePtr left = Erase(node->left, key, edit, pool, displaced);
+		if (!displaced)
+			return node;
+
+		NodePtr result = Own(node, edit, pool);
+		result->left = left;
+		return result;
+	}
+
+	if (node->GetKey() < key)
+	{
+		NodePtr right = Erase(node->right, key, edit, pool, displaced);
+		if (!displaced)
+			return node;
+
+		NodePtr result = Own(node, edit, pool);
+		result->right = right;
+		return result;
+	}
+
+	displaced = node->value;
+	return Merge(node->left, node->right, edit, pool);
+}
+
+template<typename K, typename V>
+typename PersistentMap<K, V>::NodePtr PersistentMap<K, V>::Merge(const NodePtr &left, const NodePtr &right, unsigned long edit, const shared_ptr<NodePool> &pool)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->priority > right->priority)
+	{
+		NodePtr result = Own(left, edit, pool);
+		result->right = Merge(result->right, right, edit, pool);
+		return result;
+	}
+
+	NodePtr result = Own(right, edit, pool);
+	result->left = Merge(left, result->left, edit, pool);
+	return result;
+}
+
+template<typename K, typename V>
+template<typename F>
+void PersistentMap<K, V>::ForEach(const NodePtr &node, F &f)
+{
+	if (!node)
+		return;
+
+	ForEach(node->left, f);
+	f(*node->value);
+	ForEach(node->right, f);
+}
+
+template<typename V>
+VersionedProductStore<V>::VersionedProductStore()
+{
+	pool = make_shared<NodePool>();
+	edit = 1;
+	batching = false;
+	versionNumber = 0;
+	latest = allocate_shared<ProductVersion<V> >(SharedPoolAllocator<ProductVersion<V> >(pool), versionNumber, working);
+	history.push_back(latest);
+}
+
+template<typename V>
+const V* VersionedProductStore<V>::Find(const string &productId) const
+{
+	const StoredProduct<V> *stored = working.Find(productId);
+	return stored ? &stored->product : 0;
+}
+
+template<typename V>
+shared_ptr<const StoredProduct<V> > VersionedProductStore<V>::FindStored(const string &productId) const
+{
+	return working.FindShared(productId);
+}
+
+template<typename V>
+void VersionedProductStore<V>::Add(const V &product)
+{
+	Insert(allocate_shared<StoredProduct<V> >(SharedPoolAllocator<StoredProduct<V> >(pool), product));
+}
+
+template<typename V>
+void VersionedProductStore<V>::Add(V &&product)
+{
+	Insert(allocate_shared<StoredProduct<V> >(SharedPoolAllocator<StoredProduct<V> >(pool), std::move(product)));
+}
+
+template<typename V>
+template<typename... Args>
+const V& VersionedProductStore<V>::Emplace(const string &productId, Args&&... args)
+{
+	shared_ptr<StoredProduct<V> > value = allocate_shared<StoredProduct<V> >(SharedPoolAllocator<StoredProduct<V> >(pool), productId, std::forward<Args>(args)...);
+	Insert(value);
+	return value->product;
+}
+
+template<typename V>
+bool VersionedProductStore<V>::Remove(const string &productId)
+{
+	shared_ptr<StoredProduct<V> > removed;
+	working = working.Erase(productId, edit, pool, removed);
+	if (!removed)
+		return false;
+
+	removed->replaced = true;
+	if (!batching)
+		Publish();
+	return true;
+}
+
+template<typename V>
+void VersionedProductStore<V>::BeginBatch()
+{
+	batching = true;
+}
+
+template<typename V>
+void VersionedProductStore<V>::EndBatch()
+{
+	batching = false;
+	Publish();
+}
+
+template<typename V>
+typename VersionedProductStore<V>::VersionPtr VersionedProductStore<V>::GetLatest() const
+{
+	return atomic_load(&latest);
+}
+
+template<typename V>
+typename VersionedProductStore<V>::VersionPtr VersionedProductStore<V>::GetVersion(size_t version) const
+{
+	lock_guard<mutex> lock(historyMutex);
+	if (version >= history.size() || !history[version])
+		throw "Version not available";
+
+	return history[version];
+}
+
+template<typename V>
+void VersionedProductStore<V>::ReleaseHistory(size_t version)
+{
+	lock_guard<mutex> lock(historyMutex);
+	for (size_t i = 0; i < version && i < history.size(); ++i)
+		history[i].reset();
+}
+
+template<typename V>
+void VersionedProductStore<V>::Reserve(size_t count)
+{
+	// a product, its node and their shared_ptr control blocks
+	pool->Reserve(count * (NodePool::GetBlockSize(sizeof(StoredProduct<V>) + SHARED_BLOCK_OVERHEAD) + NodePool::GetBlockSize(sizeof(typename PersistentMap<ProductId, StoredProduct<V> >::Node) + SHARED_BLOCK_OVERHEAD)));
+}
+
+template<typename V>
+MemoryUsage VersionedProductStore<V>::GetMemoryUsage() const
+{
+	const size_t productBlock = NodePool::GetBlockSize(sizeof(StoredProduct<V>) + SHARED_BLOCK_OVERHEAD);
+	const size_t nodeBlock = NodePool::GetBlockSize(sizeof(typename PersistentMap<ProductId, StoredProduct<V> >::Node) + SHARED_BLOCK_OVERHEAD);
+
+	MemoryUsage usage;
+	usage.count = working.GetSize();
+	usage.indexBytes = usage.count * nodeBlock;
+	working.ForEach([&usage, productBlock](const StoredProduct<V> &stored) { usage.payloadBytes += productBlock + stored.product.GetHeapBytes(); });
+	usage.reservedBytes = pool->GetBytesReserved();
+	return usage;
+}
+
+template<typename V>
+void VersionedProductStore<V>::Clear()
+{
+	// start over from an empty version 0, published in one step so that readers see either the
+	// old latest version or the new one; it takes no pool memory, so the pool can be reset below
+	working.ForEach([](const StoredProduct<V> &stored) { stored.replaced = true; });
+	working = PersistentMap<ProductId, StoredProduct<V> >();
+	edit = 1;
+	versionNumber = 0;
+	VersionPtr empty = make_shared<ProductVersion<V> >(versionNumber, working);
+	{
+		lock_guard<mutex> lock(historyMutex);
+		history.clear();
+		history.push_back(empty);
+	}
+	atomic_store(&latest, empty);
+
+	// the store's own reference is the last one unless a snapshot still pins allocations from the pool
+	if (pool.use_count() == 1)
+		pool->Reset();
+	else
+		pool = make_shared<NodePool>();
+}
+
+template<typename V>
+void VersionedProductStore<V>::Insert(const shared_ptr<StoredProduct<V> > &product)
+{
+	shared_ptr<StoredProduct<V> > displaced;
+	working = working.Insert(product, edit, pool, displaced);
+	if (displaced)
+		displaced->replaced = true;
+	if (!batching)
+		Publish();
+}
+
+template<typename V>
+void VersionedProductStore<V>::Publish()
+{
+	VersionPtr version = allocate_shared<ProductVersion<V> >(SharedPoolAllocator<ProductVersion<V> >(pool), versionNumber + 1, working);
+	{
+		lock_guard<mutex> lock(historyMutex);
+		history.push_back(version);
+	}
+	atomic_store(&latest, version);
+	++versionNumber;
+
+	// nodes of the published version are shared from now on
+	++edit;
+}
+
+#endif